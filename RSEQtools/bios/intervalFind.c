@@ -8,10 +8,12 @@
 
 /**
  *   \file intervalFind.c Module to efficiently find intervals that overlap with a query interval.
- *   The algorithm is based on containment sublists. 
-     See Alekseyenko, A.V., Lee, C.J. (2007) Nested Containment List (NCList): A new algorithm for 
-     accelerating interval query of genome alignment and interval databases. Bioinformatics 23: 1386-1393.
-     (http://bioinformatics.oxfordjournals.org/cgi/content/abstract/23/11/1386)
+ *   The intervals of each chromosome are kept in one array sorted by start, which is 
+     laid out as an implicit augmented binary search tree: the node at index i of level k 
+     (i has exactly k trailing 1 bits) has its children at i - 2^(k-1) and i + 2^(k-1), and 
+     every node stores the maximal end of its subtree. A query visits O(log n) nodes plus the 
+     overlapping intervals, regardless of how the intervals nest. 
+     See Li, H. cgranges (https://github.com/lh3/cgranges) for the layout.
  *   \author Lukas Habegger (lukas.habegger@yale.edu)
  *   Note: The Interval format is zero-based and half-open.
  */
@@ -19,17 +21,28 @@
 
 
 typedef struct {
-  char* chromosome;
   int start;
   int end;
-  Array sublist;  // of type Interval*
-} SuperInterval;
+  int maxEnd; // largest end in the subtree rooted at this node
+  Interval *interval;
+} IntervalNode;
+
+
+
+typedef struct {
+  char* chromosome;
+  int firstNode; // index of the chromosome's first IntervalNode
+  int numNodes;
+  int maxLevel; // level of the root node
+} ChromosomeNodes;
 
 
 
 static Array intervals = NULL;
-static Array superIntervals = NULL;
-static int superIntervalAssigned = 0;
+static Array nodes = NULL; // of type IntervalNode
+static Array chromosomes = NULL; // of type ChromosomeNodes, sorted by name
+static int indexBuilt = 0;
+static ChromosomeNodes *lastChromosome = NULL; // chromosome of the previous query
 
 
 
@@ -193,6 +206,7 @@ void intervalFind_addIntervalsToSearchSpace (char* fileName, int source)
 {
   intervals = arrayCreate (100000,Interval);
   parseFileContent (intervals,fileName,source);
+  indexBuilt = 0;
 }
 
 
@@ -216,86 +230,188 @@ Array intervalFind_parseFile (char* fileName, int source)
 
 
 
-static int sortIntervalsByChromosomeAndStartAndEnd (Interval *a, Interval *b)
+static int sortIntervalPointersByChromosomeAndStart (Interval **a, Interval **b)
 {
   int diff;
 
-  diff = strcmp (a->chromosome,b->chromosome);
+  diff = strcmp ((*a)->chromosome,(*b)->chromosome);
   if (diff != 0) {
     return diff;
   } 
-  diff = a->start - b->start;
-  if (diff != 0) {
-    return diff;
-  }
-  return b->end - a->end;
+  return (*a)->start - (*b)->start;
 }
 
 
 
-static int sortSuperIntervalsByChromosomeAndStartAndEnd (SuperInterval *a, SuperInterval *b)
+static int sortChromosomesByName (ChromosomeNodes *a, ChromosomeNodes *b)
 {
-  int diff;
+  return strcmp (a->chromosome,b->chromosome);
+}
 
-  diff = strcmp (a->chromosome,b->chromosome);
-  if (diff != 0) {
-    return diff;
-  } 
-  diff = a->start - b->start;
-  if (diff != 0) {
-    return diff;
+
+
+/**
+ * Compute the maxEnd of every node of one chromosome's tree, bottom up.
+ * @return The level of the root node.
+ */
+static int indexNodes (IntervalNode *a, int n)
+{
+  int i,k,x,lastIndex,last,e;
+
+  if (n == 0) {
+    return -1;
+  }
+  // level 0: the leaves at even indices
+  for (i = 0; i < n; i += 2) {
+    lastIndex = i;
+    last = a[i].maxEnd = a[i].end;
+  }
+  for (k = 1; (1 << k) <= n; k++) {
+    x = 1 << (k - 1);
+    for (i = (x << 1) - 1; i < n; i += x << 2) {
+      e = a[i].end;
+      e = MAX (e,a[i - x].maxEnd);
+      // a missing right child stands for the rightmost subtree
+      e = MAX (e,i + x < n ? a[i + x].maxEnd : last);
+      a[i].maxEnd = e;
+    }
+    lastIndex = (lastIndex >> k & 1) ? lastIndex - x : lastIndex + x;
+    if (lastIndex < n && a[lastIndex].maxEnd > last) {
+      last = a[lastIndex].maxEnd;
+    }
   }
-  return b->end - a->end;
+  return k - 1;
 }
 
 
 
-static void assignSuperIntervals (void)
+static void buildIndex (void)
 {
-  int i,j;
-  Interval *currInterval,*nextInterval;
-  SuperInterval *currSuperInterval;
-
-  superIntervals = arrayCreate (100000,SuperInterval);
-  arraySort (intervals,(ARRAYORDERF)sortIntervalsByChromosomeAndStartAndEnd);
-  i = 0;
-  while (i < arrayMax (intervals)) {
-    currInterval = arrp (intervals,i,Interval);
-    currSuperInterval = arrayp (superIntervals,arrayMax (superIntervals),SuperInterval);
-    currSuperInterval->chromosome = hlr_strdup (currInterval->chromosome);
-    currSuperInterval->start = currInterval->start; 
-    currSuperInterval->end = currInterval->end;
-    currSuperInterval->sublist = arrayCreate (10,Interval*);
-    array (currSuperInterval->sublist,arrayMax (currSuperInterval->sublist),Interval*) = currInterval;
-    j = i + 1;
-    while (j < arrayMax (intervals)) {
-      nextInterval = arrp (intervals,j,Interval);
-      if (strEqual (currInterval->chromosome,nextInterval->chromosome) &&
-	  currInterval->start <= nextInterval->start && 
-	  currInterval->end >= nextInterval->end) { 
-	array (currSuperInterval->sublist,arrayMax (currSuperInterval->sublist),Interval*) = nextInterval;
-      }
-      else {
-	break;
-      }
-      j++;
+  Array intervalPointers;
+  IntervalNode *currNode;
+  ChromosomeNodes *currChromosome;
+  Interval *currInterval;
+  int i;
+
+  if (nodes == NULL) {
+    nodes = arrayCreate (arrayMax (intervals),IntervalNode);
+    chromosomes = arrayCreate (100,ChromosomeNodes);
+  }
+  else {
+    arrayClear (nodes);
+    for (i = 0; i < arrayMax (chromosomes); i++) {
+      hlr_free (arrp (chromosomes,i,ChromosomeNodes)->chromosome);
+    }
+    arrayClear (chromosomes);
+    lastChromosome = NULL;
+  }
+  // the intervals themselves stay in place, so that pointers to them remain valid
+  intervalPointers = intervalFind_getIntervalPointers ();
+  arraySort (intervalPointers,(ARRAYORDERF)sortIntervalPointersByChromosomeAndStart);
+  currChromosome = NULL;
+  for (i = 0; i < arrayMax (intervalPointers); i++) {
+    currInterval = arru (intervalPointers,i,Interval*);
+    if (currChromosome == NULL || !strEqual (currChromosome->chromosome,currInterval->chromosome)) {
+      currChromosome = arrayp (chromosomes,arrayMax (chromosomes),ChromosomeNodes);
+      currChromosome->chromosome = hlr_strdup (currInterval->chromosome);
+      currChromosome->firstNode = arrayMax (nodes);
+      currChromosome->numNodes = 0;
     }
-    i = j;
+    currNode = arrayp (nodes,arrayMax (nodes),IntervalNode);
+    currNode->start = currInterval->start;
+    currNode->end = currInterval->end;
+    currNode->interval = currInterval;
+    currChromosome->numNodes++;
+  }
+  arrayDestroy (intervalPointers);
+  for (i = 0; i < arrayMax (chromosomes); i++) {
+    currChromosome = arrp (chromosomes,i,ChromosomeNodes);
+    currChromosome->maxLevel = indexNodes (arrp (nodes,currChromosome->firstNode,IntervalNode),currChromosome->numNodes);
   }
-  arraySort (superIntervals,(ARRAYORDERF)sortSuperIntervalsByChromosomeAndStartAndEnd);
+  indexBuilt = 1;
 }
 
 
 
-static void addIntervals (Array matchingIntervals, Array sublist, int start, int end) 
+static ChromosomeNodes* findChromosome (char *chromosome)
 {
-  int i;
-  Interval *currInterval;
+  ChromosomeNodes testChromosome;
+  int index;
+
+  // queries usually come in runs on the same chromosome
+  if (lastChromosome != NULL && strEqual (lastChromosome->chromosome,chromosome)) {
+    return lastChromosome;
+  }
+  testChromosome.chromosome = chromosome;
+  if (!arrayFind (chromosomes,&testChromosome,&index,(ARRAYORDERF)sortChromosomesByName)) {
+    return NULL;
+  }
+  lastChromosome = arrp (chromosomes,index,ChromosomeNodes);
+  return lastChromosome;
+}
+
+
+
+typedef struct {
+  int index;
+  int level;
+  int leftDone;
+} TreeStackEntry;
 
-  for (i = 0; i < arrayMax (sublist); i++) {
-    currInterval = arru (sublist,i,Interval*);
-    if (rangeIntersection (currInterval->start,currInterval->end,start,end) >= 0) {
-      array (matchingIntervals,arrayMax (matchingIntervals),Interval*) = currInterval;
+
+
+/**
+ * Add the intervals of one chromosome's tree that overlap [start,end]; like the 
+ * rangeIntersection() test, intervals that only touch the query are included.
+ */
+static void addOverlappingNodes (Array matchingIntervals, IntervalNode *a, int n, int maxLevel, int start, int end)
+{
+  TreeStackEntry stack[64],z;
+  int t,i,i0,i1,y;
+
+  if (n == 0) {
+    return;
+  }
+  t = 0;
+  stack[t].index = (1 << maxLevel) - 1;
+  stack[t].level = maxLevel;
+  stack[t].leftDone = 0;
+  t++;
+  while (t > 0) {
+    z = stack[--t];
+    if (z.level <= 3) {
+      // small subtree: scan its nodes in order
+      i0 = z.index >> z.level << z.level;
+      i1 = i0 + (1 << (z.level + 1)) - 1;
+      if (i1 > n) {
+        i1 = n;
+      }
+      for (i = i0; i < i1 && a[i].start <= end; i++) {
+        if (a[i].end >= start) {
+          array (matchingIntervals,arrayMax (matchingIntervals),Interval*) = a[i].interval;
+        }
+      }
+    }
+    else if (z.leftDone == 0) {
+      y = z.index - (1 << (z.level - 1));
+      stack[t] = z;
+      stack[t].leftDone = 1;
+      t++;
+      if (y >= n || a[y].maxEnd >= start) {
+        stack[t].index = y;
+        stack[t].level = z.level - 1;
+        stack[t].leftDone = 0;
+        t++;
+      }
+    }
+    else if (z.index < n && a[z.index].start <= end) {
+      if (a[z.index].end >= start) {
+        array (matchingIntervals,arrayMax (matchingIntervals),Interval*) = a[z.index].interval;
+      }
+      stack[t].index = z.index + (1 << (z.level - 1));
+      stack[t].level = z.level - 1;
+      stack[t].leftDone = 0;
+      t++;
     }
   }
 }
@@ -314,14 +430,11 @@ static void addIntervals (Array matchingIntervals, Array sublist, int start, int
  */
 Array intervalFind_getOverlappingIntervals (char* chromosome, int start, int end)
 {
-  SuperInterval testSuperInterval;
-  SuperInterval *currSuperInterval;
-  int i,index;
+  ChromosomeNodes *currChromosome;
   static Array matchingIntervals = NULL;
 
-  if (superIntervalAssigned == 0) {
-     assignSuperIntervals ();
-     superIntervalAssigned = 1;
+  if (indexBuilt == 0) {
+    buildIndex ();
   }
   if (matchingIntervals == NULL) {
     matchingIntervals = arrayCreate (20,Interval*);
@@ -329,28 +442,10 @@ Array intervalFind_getOverlappingIntervals (char* chromosome, int start, int end
   else {
     arrayClear (matchingIntervals);
   }
-  testSuperInterval.chromosome = chromosome;
-  testSuperInterval.start = start;
-  testSuperInterval.end = end;
-  arrayFind (superIntervals,&testSuperInterval,&index,(ARRAYORDERF)sortSuperIntervalsByChromosomeAndStartAndEnd);
-  // Index points to the location where testSuperInterval would be inserted
-  i = index;
-  while (i >= 0) {
-    currSuperInterval = arrp (superIntervals,i,SuperInterval);
-    if (!strEqual (currSuperInterval->chromosome,chromosome) || currSuperInterval->end < start) {
-      break;
-    }
-    addIntervals (matchingIntervals,currSuperInterval->sublist,start,end); 
-    i--;
-  }
-  i = index + 1;
-  while (i < arrayMax (superIntervals)) {
-    currSuperInterval = arrp (superIntervals,i,SuperInterval);
-    if (!strEqual (currSuperInterval->chromosome,chromosome) ||  currSuperInterval->start > end) {
-      break;
-    }
-    addIntervals (matchingIntervals,currSuperInterval->sublist,start,end); 
-    i++;
+  currChromosome = findChromosome (chromosome);
+  if (currChromosome != NULL) {
+    addOverlappingNodes (matchingIntervals,arrp (nodes,currChromosome->firstNode,IntervalNode),
+                         currChromosome->numNodes,currChromosome->maxLevel,start,end);
   }
   return matchingIntervals;
 }
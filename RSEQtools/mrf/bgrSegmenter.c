@@ -20,8 +20,8 @@ int main (int argc, char *argv[])
   char *targetName;
   char *line;
   int i;
-  Array wigs;
-  Wig *currWig;
+  Array wigRuns;
+  WigRun *currRun;
   double threshold;
   int maxGap;
   int minRun;
@@ -36,41 +36,33 @@ int main (int argc, char *argv[])
   minRun = atoi (argv[4]);
   buffer = stringCreate (100);
   tars = arrayCreate (1000000,Tar);
-  wigs = arrayCreate (250000000,Wig);
+  wigRuns = arrayCreate (1000000,WigRun);
   stringPrintf (buffer,"ls -1 %s*.bgr",argv[1]);
   ls1 = ls_createFromPipe (string (buffer));
   while (fileName = ls_nextLine (ls1)) {
     ls2 = ls_createFromFile (fileName);
-    ls_nextLine (ls2); // discard track name line
-    int prevEnd = 0;
+    targetName = NULL;
     while (line = ls_nextLine (ls2)) {
-      if ( strStartsWithC( line, "track" ) || 
+      // header lines are skipped wherever they are, as by
+      // segment_bedgraphs_into_loci; the first line may hold data
+      if ( line[0] == '\0' || line[0] == '#' ||
+	   strStartsWithC( line, "track" ) || 
 	   strStartsWithC( line, "chrom" ) ) 
 	continue;
       WordIter w = wordIterCreate( line, "\t", 0 );
+      hlr_free (targetName);
       targetName = hlr_strdup ( wordNext(w));
-      int start = atoi( wordNext ( w ) ) + 1;
-      int end = atoi( wordNext ( w ) );
-      float value = atof( wordNext( w ) );
-      //if( prevEnd > -1) {
-	for( i=prevEnd; i < start; i++) {
-	  currWig = arrayp (wigs,arrayMax (wigs),Wig);
-	  currWig->position = i;
-	  currWig->value = 0;
-	}
-	//}
-      for( i=start; i < (end+1); i++) {
-	currWig = arrayp (wigs,arrayMax (wigs),Wig);
-	currWig->position = i;
-	currWig->value = value;
-      }
-      prevEnd = end+1;
+      // one run per bedGraph line; the gaps in between are 0
+      currRun = arrayp (wigRuns,arrayMax (wigRuns),WigRun);
+      currRun->start = atoi( wordNext ( w ) ) + 1;
+      currRun->end = atoi( wordNext ( w ) );
+      currRun->value = atof( wordNext( w ) );
       wordIterDestroy( w );
     }
     ls_destroy (ls2);
 
-    performSegmentation (tars,wigs,targetName,threshold,maxGap,minRun);
-    arrayClear (wigs);
+    performRunSegmentation (tars,wigRuns,targetName,threshold,maxGap,minRun);
+    arrayClear (wigRuns);
     warn ("Done with %s",targetName); 
     hlr_free (targetName);
   }
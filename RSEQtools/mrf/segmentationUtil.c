@@ -51,3 +51,92 @@ void performSegmentation (Array tars, Array wigs, char* targetName, double thres
   }
 }
 
+
+
+typedef struct {
+  int inTar;
+  int tarStart;
+  int endPosition;
+  int countBelowThreshold;
+} RunSegmentationState;
+
+
+
+static void addTar (Array tars, char* targetName, int start, int endPosition, int minRun)
+{
+  Tar *currTar;
+
+  if ((endPosition - 1 - start + 1) >= minRun) {
+    currTar = arrayp (tars,arrayMax (tars),Tar);
+    currTar->start = start;
+    currTar->end = endPosition + 1;
+    currTar->targetName = hlr_strdup (targetName);
+  }
+}
+
+
+
+/**
+ * Feed the positions [start, end) with the same value into the segmentation.
+ */
+static void segmentRun (Array tars, RunSegmentationState *state, char* targetName, 
+                        int start, int end, float value, 
+                        double threshold, int maxGap, int minRun)
+{
+  if (end <= start) {
+    return;
+  }
+  if (value >= threshold) {
+    if (!state->inTar) {
+      state->inTar = 1;
+      state->tarStart = start;
+      state->endPosition = start + 1;
+      if (end - start == 1) {
+        state->countBelowThreshold = 0;
+        return;
+      }
+    }
+    state->countBelowThreshold = 0;
+    state->endPosition = end - 1;
+  }
+  else if (state->inTar) {
+    state->countBelowThreshold += end - start;
+    if (state->countBelowThreshold >= maxGap) {
+      state->inTar = 0;
+      addTar (tars,targetName,state->tarStart,state->endPosition,minRun);
+    }
+  }
+}
+
+
+
+/**
+ * Same as performSegmentation(), but on runs of positions sorted by start 
+ * instead of one Wig per position. Positions between runs (and before the 
+ * first run, from 0 on) have value 0. Runs are evaluated as a whole, so 
+ * time and memory are proportional to the number of runs.
+ * MaxGapSegmenter in CoRAL's segment.h implements the same state machine 
+ * for segment_coverage_into_loci and segment_bedgraphs_into_loci; keep 
+ * the two in step.
+ */
+void performRunSegmentation (Array tars, Array wigRuns, char* targetName, double threshold, int maxGap, int minRun)
+{
+  RunSegmentationState state;
+  WigRun *currRun;
+  int i,prevEnd;
+
+  state.inTar = 0;
+  state.tarStart = 0;
+  state.endPosition = 0;
+  state.countBelowThreshold = 0;
+  prevEnd = 0;
+  for (i = 0; i < arrayMax (wigRuns); i++) {
+    currRun = arrp (wigRuns,i,WigRun);
+    segmentRun (tars,&state,targetName,prevEnd,currRun->start,0,threshold,maxGap,minRun);
+    segmentRun (tars,&state,targetName,currRun->start,currRun->end + 1,currRun->value,threshold,maxGap,minRun);
+    prevEnd = currRun->end + 1;
+  }
+  if (state.inTar) {
+    addTar (tars,targetName,state.tarStart,state.endPosition,minRun);
+  }
+}
@@ -24,8 +24,22 @@ typedef struct {
 
 
 
+/**
+ * A run of consecutive positions [start, end] with the same value, 
+ * e.g. one bedGraph line.
+ */
+typedef struct {
+  int start;
+  int end;
+  float value;
+} WigRun;
+
+
+
 extern void performSegmentation (Array tars, Array wigs, char* targetName, 
                                  double threshold, int maxGap, int minRun);
+extern void performRunSegmentation (Array tars, Array wigRuns, char* targetName, 
+                                    double threshold, int maxGap, int minRun);
 
 
 
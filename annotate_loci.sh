@@ -35,45 +35,12 @@ CLASSPRI=$3
 
 OUT=${1%.bed}.annot
 
-if [ -z $TMPDIR ]; then
-    export TMPDIR=/tmp
-fi
-
-cp $IN ${TMPDIR}/$$.in
-cp $GFF ${TMPDIR}/$$.gff
-
-# add antisense annotations and append them to sense
-cat ${TMPDIR}/$$.gff | awk 'BEGIN{OFS="\t"}
-  { if($7 == "+")
-    { $7 = "-" }
-    else { $7 = "+" }
-    $3 = "as-"$3; print $0}' > ${TMPDIR}/$$.gff2
-cat ${TMPDIR}/$$.gff ${TMPDIR}/$$.gff2 > ${TMPDIR}/$$.gff3
-mv ${TMPDIR}/$$.gff3 ${TMPDIR}/$$.gff
-
-# sort inputs
-cat ${TMPDIR}/$$.in | sort -k1,1 -k2,2n > ${TMPDIR}/$$.sorted.bed
-cat ${TMPDIR}/$$.gff | sort -k1,1 -nk4,4 > ${TMPDIR}/$$.sorted.gff
-
-intersectBed -s -wo -a ${TMPDIR}/$$.sorted.gff \
-  -b ${TMPDIR}/$$.sorted.bed > ${TMPDIR}/$$.intersect
-
-cat ${TMPDIR}/$$.intersect | sort -k13,13 -k16,16nr | \
-  awk '{print $13"\t"$3"\t"$16"\t"$9}' > ${TMPDIR}/$$.intersect2 
-
-cut -f4 ${TMPDIR}/$$.sorted.bed | sort | \
-  awk '{print $0"\tintergenic\t-1\t."}' | \
-  sort -k1 -m - ${TMPDIR}/$$.intersect2 > ${TMPDIR}/$$.intersect3
-
-# Run the class prioritization
+# Intersect the loci with the sense and antisense annotations,
+# run the class prioritization (output sorted by locus)
 # and split snoRNAs into 3 subclasses
 if [ -e `dirname $GFF`/frnadb_snorna.txt ]; then
   use_frnadb=`dirname $GFF`/frnadb_snorna.txt
 fi
 
-
-annotate_smrna_loci ${TMPDIR}/$$.intersect3 $CLASSPRI | 
-  sort -k1 | \
+annotate_smrna_loci --gff $IN $GFF $CLASSPRI | \
   annotate_snornas.sh $use_frnadb > $OUT
-
-rm ${TMPDIR}/$$.*
@@ -24,153 +24,414 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <map>
+#include <getopt.h>
+#include "tokenizer.h"
+#include "locus.h"
 
-#ifdef __GNUC__
-#include <ext/hash_map>
-#else
-#include <hash_map>
-#endif
-
-// allow hash_map to use std::string keys
-namespace __gnu_cxx {
-  template<> struct hash< std::string > {
-    size_t operator()( const std::string& x ) const {
-      return hash< const char* >()( x.c_str() );
-    }
-  };
-}
-namespace std {  using namespace __gnu_cxx; }
 using namespace std;
 
 /////////////////////////////
 
-class Overlap {
+// the annotation classes, interned to small ids; classes that are not
+// in the priority file get priority 0, as before
+class ClassTable {
+  map<string, int> ids;
+  vector<string> names;
+  vector<int> priorities;
+
 public:
-  string locus_id;
-  string type;
+  int id(const string &name) {
+    map<string, int>::const_iterator it = ids.find(name);
+    if (it != ids.end())
+      return it->second;
+    ids.insert(make_pair(name, int(names.size())));
+    names.push_back(name);
+    priorities.push_back(0);
+    return names.size() - 1;
+  }
+
+  void set_priority(const string &name, int priority) {
+    priorities[id(name)] = priority;
+  }
+
+  const string &name(int id) const { return names[id]; }
+  int priority(int id) const { return priorities[id]; }
+  size_t size() const { return names.size(); }
+};
+
+ClassTable classes;
+const int INTERGENIC = classes.id("intergenic");
+
+struct Overlap {
+  int type;
   int amount;
   string desc;
+};
 
-  Overlap(const string& line) {
-    istringstream iss(line);
-    string tmp;
-    getline(iss, locus_id, '\t');
-    getline(iss, type, '\t');
-    getline(iss, tmp, '\t');
-    istringstream iss2(tmp);
-    iss2 >> amount;
-    getline(iss, desc, '\t');
+// the overlaps of one locus; the rows are reused from locus to locus,
+// so that their strings keep their buffers
+class LocusOverlaps {
+  vector<Overlap> rows;
+  size_t n;
+
+public:
+  string locus_id;
+
+  LocusOverlaps() : n(0) { }
+
+  void clear() { n = 0; }
+  bool empty() const { return n == 0; }
+  size_t size() const { return n; }
+  const Overlap &operator[](size_t i) const { return rows[i]; }
+
+  Overlap &add() {
+    if (n == rows.size())
+      rows.push_back(Overlap());
+    return rows[n++];
+  }
+
+  void add(int type, int amount, const string &desc) {
+    Overlap &o = add();
+    o.type = type;
+    o.amount = amount;
+    o.desc = desc;
   }
 };
 
 class OverlapComparator {
-  hash_map<string,int> &clspri;
+  const LocusOverlaps &overlaps;
 public:
-  OverlapComparator(hash_map<string,int> &cp) : clspri(cp) { }
-  bool operator()  (const Overlap &a, const Overlap &b) {
-    return( clspri[a.type] < clspri[b.type] );
+  OverlapComparator(const LocusOverlaps &o) : overlaps(o) { }
+  bool operator()  (size_t a, size_t b) const {
+    return( classes.priority(overlaps[a].type) < classes.priority(overlaps[b].type) );
   }
 };
 
-hash_map<string,int> class_priorities;
-OverlapComparator compare_overlaps_by_priority(class_priorities);
-
-void process_buffer(const string& b) {
-  string line;
-  istringstream iss(b);
-  vector<Overlap> overlaps;
+// per-class counts of the current locus, and the classes in order of
+// first appearance
+vector<int> type_counts;
+vector<int> types;
+vector<size_t> by_priority;
 
-  while(getline(iss, line))
-    overlaps.push_back(Overlap(line));
+void process_buffer(const LocusOverlaps& overlaps) {
+  if (overlaps.empty())
+    return;
 
-  hash_map<string, int> types;
-  vector<string> type_list;
-  string basic_type;
-  string basic_desc;
+  type_counts.resize(classes.size(), 0);
+  int basic_type = -1;
   for(size_t i=0; i < overlaps.size(); ++i) {
-    if (types.find(overlaps[i].type) == types.end())
-      types[ overlaps[i].type ] = 0;
+    int type = overlaps[i].type;
+    if (type_counts[type]++ == 0)
+      types.push_back(type);
+    if (type != INTERGENIC)
+      basic_type = type;
+  }
 
-    types[ overlaps[i].type ] = types[overlaps[i].type] + 1;
-    if (overlaps[i].type != "intergenic")
-      basic_type = overlaps[i].type;
-    basic_desc += overlaps[i].desc;
-    basic_desc += ",";
+  // Output: basic_class prioritized_class all_classes  basic_desc  prioritized_desc
+
+  by_priority.clear();
+  for(size_t i=0; i < overlaps.size(); ++i)
+    by_priority.push_back(i);
+  sort(by_priority.begin(), by_priority.end(), OverlapComparator(overlaps));
+  const Overlap &pri = overlaps[by_priority[0]];
+
+  cout << overlaps.locus_id << "\t";
+  if (types.size() > 2)   // includes intergenic type
+    cout << "multi";
+  else if (types.size() == 1)
+    cout << "intergenic";
+  else if (basic_type >= 0)
+    cout << classes.name(basic_type);
+  cout << "\t" << classes.name(pri.type) << "\t";
+  for(size_t i=0; i < types.size(); ++i) {
+    for(int j=0; j < type_counts[types[i]]; ++j)
+      cout << classes.name(types[i]) << ",";
+    type_counts[types[i]] = 0;
   }
-  //cout << types.size() << "\n";
+  types.clear();
+  cout << "\t";
+  for(size_t i=0; i < overlaps.size(); ++i)
+    cout << overlaps[i].desc << ",";
+  cout << "\t" << pri.desc << "\n";
+}
+
+/////////////////////
+// --gff mode: the loci are intersected with the annotation in memory,
+// as annotate_loci.sh did with awk, sort and intersectBed
 
-  if (types.size() > 2) {   // includes intergenic type
-    basic_type = "multi";
-  } else if (types.size() == 1)  {
-    basic_type = "intergenic";
+// a GFF feature as a 0-based half-open interval
+struct GFFFeature {
+  size_t start, end;
+  string strand;
+  string type;
+  int type_id, as_type_id;
+  string desc;   // the attributes, up to the first blank
+  string line;
+  string as_line;   // antisense_gff_line(), once it overlaps a locus
+};
+
+// the whitespace-separated fields of a line, rejoined by tabs, with the
+// type and strand of the antisense copy; as the awk script wrote it
+string antisense_gff_line(const GFFFeature &feature) {
+  istringstream iss(feature.line);
+  string field, result;
+  for(int i=0; iss >> field; ++i) {
+    if (i == 2)
+      field = "as-" + field;
+    else if (i == 6)
+      field = field == "+" ? "-" : "+";
+    if (i > 0)
+      result += "\t";
+    result += field;
+  }
+  return result;
+}
+
+bool read_gff(const char *fn, map<string, vector<GFFFeature> > &features) {
+  ifstream gff_file(fn);
+  if (!gff_file.is_open())
+    return false;
+  string line, chr, field;
+  while(getline(gff_file, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    FieldTokenizer fields(line);
+    const char *b = line.data(), *e = b;
+    GFFFeature feature;
+    fields.next(chr);
+    fields.skip();
+    fields.next(feature.type);
+    feature.type_id = classes.id(feature.type);
+    feature.as_type_id = classes.id("as-" + feature.type);
+    fields.next(b, e);
+    feature.start = parse_long(b, e) - 1;
+    fields.next(b, e);
+    feature.end = parse_long(b, e);
+    fields.skip();
+    fields.next(feature.strand);
+    fields.skip();
+    fields.next(field);
+    feature.desc = field.substr(0, field.find_first_of(" \t"));
+    feature.line = line;
+    features[chr].push_back(feature);
   }
+  return true;
+}
 
-  // Output: basic_class prioritized_class all_classes  basic_desc  prioritized_desc
+bool by_start(const GFFFeature &a, const GFFFeature &b) {
+  return a.start < b.start;
+}
 
-  sort(overlaps.begin(), overlaps.end(), compare_overlaps_by_priority);
-  string pri_type(overlaps[0].type);
-  string pri_desc(overlaps[0].desc);
+// an annotation overlap of a locus, before class prioritization
+struct LocusOverlap {
+  const GFFFeature *feature;
+  bool antisense;
+  int amount;
 
-  cout << overlaps[0].locus_id << "\t" << basic_type << "\t" << pri_type << "\t";
-  for( hash_map<string,int>::iterator it=types.begin(); it != types.end(); ++it) {
-    for(int i=0; i < (it->second); ++i) 
-      cout << (it->first) << ",";
+  int type() const {
+    return antisense ? feature->as_type_id : feature->type_id;
+  }
+  // the sort key; as_line is filled in before the overlaps are sorted
+  const string &line() const {
+    return antisense ? feature->as_line : feature->line;
   }
-  cout << "\t" << basic_desc << "\t" << pri_desc << "\n";
+};
+
+// largest overlap first; ties by the text of the feature line, as the
+// intersections were sorted
+bool by_amount(const LocusOverlap &a, const LocusOverlap &b) {
+  if (a.amount != b.amount)
+    return a.amount > b.amount;
+  return a.line() < b.line();
 }
 
-/////////////////////
+bool loci_by_start(const BEDEntry *a, const BEDEntry *b) {
+  return a->start < b->start;
+}
 
-int main(int argc, char **argv) {
-  if (argc < 3) {
-    cerr << "USAGE: " << argv[0] << " in.intersect3 class_pri.txt\n";
+bool loci_by_name(const BEDEntry *a, const BEDEntry *b) {
+  return a->name < b->name;
+}
+
+int annotate_from_gff(const char *bed_fn, const char *gff_fn) {
+  ifstream bed_file(bed_fn);
+  if (!bed_file.is_open()) {
+    cerr << "Could not open BED file " << bed_fn << "\n";
     return 1;
   }
+  vector<BEDEntry> loci;
+  string line;
+  while(getline(bed_file, line)) {
+    loci.push_back(BEDEntry());
+    parse_bed_line(line, loci.back());
+  }
 
-  ifstream intersect_file(argv[1]);
-  if (!intersect_file.is_open()) {
-    cerr << "Could not open intersect file " << argv[1] << "\n";
+  map<string, vector<GFFFeature> > features;
+  if (!read_gff(gff_fn, features)) {
+    cerr << "Could not open GFF file " << gff_fn << "\n";
     return 1;
   }
 
-  ifstream clspri_file(argv[2]);
-  if (!clspri_file.is_open()) {
-    cerr << "Could not open class priority file " << argv[2] << "\n";
-    return 1;
+  map<string, vector<const BEDEntry *> > chr_loci;
+  for(size_t i=0; i < loci.size(); ++i)
+    chr_loci[loci[i].chr].push_back(&loci[i]);
+
+  // sweep the loci of each chromosome against its features, both in
+  // order of start; a feature overlaps a locus on its own strand as
+  // itself, and on the opposite strand as "as-" type (unstranded
+  // features only as antisense of + loci, as the awk script flipped them)
+  map<const BEDEntry *, vector<LocusOverlap> > overlaps;
+  map<string, vector<const BEDEntry *> >::iterator cl;
+  for(cl = chr_loci.begin(); cl != chr_loci.end(); ++cl) {
+    vector<GFFFeature> &chr_features = features[cl->first];
+    sort(chr_features.begin(), chr_features.end(), by_start);
+    vector<const BEDEntry *> &chr_loci = cl->second;
+    sort(chr_loci.begin(), chr_loci.end(), loci_by_start);
+
+    size_t next = 0;
+    vector<GFFFeature *> active;
+    for(size_t i=0; i < chr_loci.size(); ++i) {
+      const BEDEntry &locus = *chr_loci[i];
+      while (next < chr_features.size() && chr_features[next].start < locus.end)
+	active.push_back(&chr_features[next++]);
+      size_t n_active = 0;
+      for(size_t j=0; j < active.size(); ++j) {
+	GFFFeature &feature = *active[j];
+	if (feature.end <= locus.start)
+	  continue;
+	active[n_active++] = active[j];
+	int amount = int(min(feature.end, locus.end)) -
+	  int(max(feature.start, locus.start));
+	if (amount <= 0)
+	  continue;
+	LocusOverlap overlap;
+	overlap.feature = &feature;
+	overlap.amount = amount;
+	if (feature.strand == locus.strand)
+	  overlap.antisense = false;
+	else if ((feature.strand == "+" ? "-" : "+") == locus.strand)
+	  overlap.antisense = true;
+	else
+	  continue;
+	if (overlap.antisense && feature.as_line.empty())
+	  feature.as_line = antisense_gff_line(feature);
+	overlaps[&locus].push_back(overlap);
+      }
+      active.resize(n_active);
+    }
   }
 
-  string line;
+  // prioritize the classes of each locus, in order of locus name; the
+  // intergenic placeholder goes where merging it into the sorted
+  // overlaps put it
+  vector<const BEDEntry *> sorted_loci;
+  for(size_t i=0; i < loci.size(); ++i)
+    sorted_loci.push_back(&loci[i]);
+  sort(sorted_loci.begin(), sorted_loci.end(), loci_by_name);
+
+  const string intergenic_row("intergenic\t-1\t.");
+  LocusOverlaps buffer;
+  for(size_t i=0; i < sorted_loci.size(); ++i) {
+    vector<LocusOverlap> &locus_overlaps = overlaps[sorted_loci[i]];
+    sort(locus_overlaps.begin(), locus_overlaps.end(), by_amount);
+
+    buffer.clear();
+    buffer.locus_id = sorted_loci[i]->name;
+    bool intergenic_added = false;
+    for(size_t j=0; j < locus_overlaps.size(); ++j) {
+      const LocusOverlap &o = locus_overlaps[j];
+      ostringstream row;
+      row << classes.name(o.type()) << "\t" << o.amount << "\t" << o.feature->desc;
+      if (!intergenic_added && row.str() >= intergenic_row) {
+	buffer.add(INTERGENIC, -1, ".");
+	intergenic_added = true;
+      }
+      buffer.add(o.type(), o.amount, o.feature->desc);
+    }
+    if (!intergenic_added)
+      buffer.add(INTERGENIC, -1, ".");
+    process_buffer(buffer);
+  }
+  return 0;
+}
 
-  // read class priorities
+bool read_class_priorities(const char *fn) {
+  ifstream clspri_file(fn);
+  if (!clspri_file.is_open())
+    return false;
+  string line;
   while(getline(clspri_file, line)) {
     istringstream iss(line);
     string k;
     int v;
     iss >> k;
     iss >> v;
-    class_priorities[k] = v;
+    classes.set_priority(k, v);
   }
+  return true;
+}
 
-  // process all overlaps
-  string prev_loc_id("");
-  string buffer;
+/////////////////////
+
+int main(int argc, char **argv) {
+  bool from_gff = false;
+  static struct option long_options[] = {
+    {"gff", no_argument, 0, 'g'},
+    {0, 0, 0, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "", long_options, NULL)) >= 0) {
+    switch (c) {
+    case 'g': from_gff = true; break;
+    default: return 1;
+    }
+  }
+  if (argc - optind < (from_gff ? 3 : 2)) {
+    cerr << "USAGE: " << argv[0] << " in.intersect3 class_pri.txt\n"
+	 << "       " << argv[0] << " --gff loci.bed genome.gff class_pri.txt\n";
+    return 1;
+  }
+  const char *clspri_fn = argv[optind + (from_gff ? 2 : 1)];
+
+  if (!read_class_priorities(clspri_fn)) {
+    cerr << "Could not open class priority file " << clspri_fn << "\n";
+    return 1;
+  }
+  if (from_gff)
+    return annotate_from_gff(argv[optind], argv[optind+1]);
+
+  ifstream intersect_file(argv[optind]);
+  if (!intersect_file.is_open()) {
+    cerr << "Could not open intersect file " << argv[optind] << "\n";
+    return 1;
+  }
+
+  // process all overlaps, one locus at a time; rows are "locus_id type
+  // amount desc"
+  LocusOverlaps buffer;
+  string line, locus_id, type;
 
   while(getline(intersect_file, line)) {
-    string curr_loc_id;
-    string dummy;
+    FieldTokenizer fields(line);
+    const char *b = line.data(), *e = b;
+    locus_id.clear();
+    type.clear();
+    fields.next(locus_id);
+    fields.next(type);
 
-    istringstream iss(line);
-    getline(iss, curr_loc_id, '\t');
-    
-    if ((!prev_loc_id.empty()) && (curr_loc_id != prev_loc_id)) {
+    if (!buffer.empty() && locus_id != buffer.locus_id) {
       process_buffer(buffer);
       buffer.clear();
     }
-    
-    buffer += line;
-    buffer += "\n";
+    if (buffer.empty())
+      buffer.locus_id = locus_id;
 
-    prev_loc_id = curr_loc_id;
+    Overlap &overlap = buffer.add();
+    overlap.type = classes.id(type);
+    overlap.amount = fields.next(b, e) ? parse_long(b, e) : 0;
+    overlap.desc.clear();
+    fields.next(overlap.desc);
   }
 
   process_buffer(buffer);
@@ -0,0 +1,180 @@
+//  Copyright (c) 2013 University of Pennsylvania
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+
+// benchmark of tokenizer.h: parses the lines of a lenvector or BED file
+// from memory with the former istringstream parsers and with the
+// FieldTokenizer ones (parse_lenvec_line, parse_bed_line), and prints
+// the lines/s of each.  Not part of `all`; build with `make bench`
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/time.h>
+#include "lenvec.h"
+#include "locus.h"
+
+using namespace std;
+
+// the istringstream parsers that tokenizer.h replaced
+void istringstream_parse_lenvec_line(const string &line, LengthVector& result,
+				     bool runs) {
+  result.data.clear();
+  istringstream line_str(line);
+  getline(line_str, result.chr, '\t');
+  getline(line_str, result.strand, '\t');
+  string bp_s;
+  getline(line_str, bp_s, '\t');
+  result.bp = atol(bp_s.c_str());
+  result.end = result.bp + 1;
+  if (runs) {
+    getline(line_str, bp_s, '\t');
+    result.end = atol(bp_s.c_str());
+  }
+  string s;
+  while(getline(line_str, s, '\t'))
+    result.data.push_back(atof(s.c_str()));
+}
+
+void istringstream_parse_bed_line(const string &line, BEDEntry &result) {
+  istringstream line_str(line);
+  getline(line_str, result.chr, '\t');
+  string s;
+  getline(line_str, s, '\t');
+  result.start = atol(s.c_str());
+  getline(line_str, s, '\t');
+  result.end = atol(s.c_str());
+  getline(line_str, result.name, '\t');
+  getline(line_str, s, '\t');
+  result.score = atoi(s.c_str());
+  getline(line_str, result.strand, '\t');
+}
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// parses every line with the old (tokenizer=false) or new parser;
+// returns a checksum of the parsed values, so that both parsers can be
+// compared and the work is not optimized away
+double parse_lines(const vector<string> &lines, bool bed, bool runs,
+		   bool tokenizer) {
+  double checksum = 0;
+  LengthVector lenvec;
+  BEDEntry entry;
+  for(size_t i = 0; i < lines.size(); ++i) {
+    if (bed) {
+      if (tokenizer)
+	parse_bed_line(lines[i], entry);
+      else
+	istringstream_parse_bed_line(lines[i], entry);
+      checksum += entry.start + entry.end + entry.score + entry.chr.size() +
+	entry.name.size() + entry.strand.size();
+    } else {
+      if (tokenizer)
+	parse_lenvec_line(lines[i], lenvec, runs);
+      else
+	istringstream_parse_lenvec_line(lines[i], lenvec, runs);
+      checksum += lenvec.bp + lenvec.end + lenvec.chr.size() +
+	lenvec.strand.size();
+      for(size_t j = 0; j < lenvec.data.size(); ++j)
+	checksum += lenvec.data[j];
+    }
+  }
+  return checksum;
+}
+
+int main(int argc, char **argv) {
+  bool bed = false;
+  int n_rounds = 3;
+  int c;
+  while ((c = getopt(argc, argv, "bn:")) >= 0) {
+    switch (c) {
+    case 'b': bed = true; break;
+    case 'n': n_rounds = atoi(optarg); break;
+    default: return(1);
+    }
+  }
+  if (argc - optind < 1 || n_rounds < 1) {
+    cerr << "USAGE: " << argv[0] << " [-b] [-n rounds] lenvector_or_bed_file\n";
+    cerr << "  -b  the file is BED (default: a text lenvector file)\n";
+    cerr << "  -n  best of this many rounds (default: 3)\n";
+    return(1);
+  }
+
+  string fn(argv[optind]);
+  ifstream infile(fn.c_str());
+  if (!infile.is_open()) {
+    cerr << "Could not open input file " << fn << "\n";
+    return(1);
+  }
+  // the lines are read up front so that only the parsing is timed
+  vector<string> lines;
+  bool runs = false;
+  size_t n_bytes = 0;
+  string line;
+  while(getline(infile, line)) {
+    if (line.empty() || line[0] == '#' ||
+	(bed && (line.compare(0, 5, "track") == 0 ||
+		 line.compare(0, 7, "browser") == 0))) {
+      runs = runs || (!bed && is_lenvec_runs_header(line));
+      continue;
+    }
+    n_bytes += line.size() + 1;
+    lines.push_back(line);
+  }
+  if (lines.empty()) {
+    cerr << "No lines to parse in " << fn << "\n";
+    return(1);
+  }
+
+  const char *names[2] = {"istringstream", "FieldTokenizer"};
+  double best[2] = {0, 0}, checksum[2] = {0, 0};
+  for(int round = 0; round < n_rounds; ++round)
+    for(int k = 0; k < 2; ++k) {
+      double start = now();
+      checksum[k] = parse_lines(lines, bed, runs, k == 1);
+      double secs = now() - start;
+      if (round == 0 || secs < best[k])
+	best[k] = secs;
+    }
+
+  cout << fn << ": " << lines.size() << " " << (bed ? "BED" : "lenvector")
+       << " lines, " << n_bytes << " bytes, best of " << n_rounds << "\n";
+  for(int k = 0; k < 2; ++k) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%-15s %12.0f lines/s %9.1f MB/s",
+	     names[k], lines.size() / best[k], n_bytes / best[k] / 1e6);
+    cout << buf << "\n";
+  }
+  cout << "speedup " << best[0] / best[1] << "x\n";
+  if (checksum[0] != checksum[1]) {
+    cerr << "The parsers disagree: checksums " << checksum[0] << " and "
+	 << checksum[1] << "\n";
+    return(1);
+  }
+  return 0;
+}
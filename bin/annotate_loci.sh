@@ -0,0 +1 @@
+../annotate_loci.sh
\ No newline at end of file
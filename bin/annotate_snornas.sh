@@ -0,0 +1 @@
+../annotate_snornas.sh
\ No newline at end of file
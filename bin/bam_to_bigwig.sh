@@ -0,0 +1 @@
+../bam_to_bigwig.sh
\ No newline at end of file
@@ -0,0 +1 @@
+../call_smrna_loci.sh
\ No newline at end of file
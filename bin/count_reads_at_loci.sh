@@ -0,0 +1 @@
+../count_reads_at_loci.sh
\ No newline at end of file
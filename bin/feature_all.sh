@@ -0,0 +1 @@
+../feature_all.sh
\ No newline at end of file
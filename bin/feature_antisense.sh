@@ -0,0 +1 @@
+../feature_antisense.sh
\ No newline at end of file
@@ -0,0 +1 @@
+../feature_batch.sh
\ No newline at end of file
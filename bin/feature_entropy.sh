@@ -0,0 +1 @@
+../feature_entropy.sh
\ No newline at end of file
@@ -0,0 +1 @@
+../feature_lengths.sh
\ No newline at end of file
@@ -0,0 +1 @@
+../feature_mfe.sh
\ No newline at end of file
@@ -0,0 +1 @@
+../feature_nuc.sh
\ No newline at end of file
@@ -0,0 +1 @@
+../make_data_matrix.sh
\ No newline at end of file
@@ -0,0 +1 @@
+../segment_bigwig_into_loci.sh
\ No newline at end of file
@@ -41,19 +41,12 @@ source $config
 outdir=`dirname $bam`/coral
 mkdir -p $outdir
 
-outprefix=`basename ${1%.bam}`
-
-###
-echo "Converting BAM to bigWig..."
-
-bam_to_bigwig.sh $bam $outdir/loci $outprefix
-
-
 ###
 echo "Segmenting coverage into transcribed loci..."
 
-segment_bigwig_into_loci.sh \
-  $outdir/loci.pos.bigwig $outdir/loci.neg.bigwig \
+# streams the strand coverage of the (sorted) bam straight into the
+# maxGap/minRun segmentation; bam_to_bigwig.sh still makes browser tracks
+segment_coverage_into_loci $bam \
   $seg_threshold $seg_maxgap $seg_minrun $outdir/loci.bed
 
 
@@ -27,115 +27,385 @@
 #include <sstream>
 #include <vector>
 #include <string>
-#include <deque>
+#include <queue>
+#include <cstdlib>
+#include <climits>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
 #include "sam.h"
+#include "lenvec.h"
 
 using namespace std;
 
-struct SeqRead {
+// the end of a read's coverage; reads leave the sweep at their end
+struct ReadEnd {
+  int end;
+  int length_idx;
   float weight;
-  int remaining_length;
-  int length;
-  SeqRead(float w, int l) : weight(w), remaining_length(l), length(l) { }
+  ReadEnd(int e, int l, float w) : end(e), length_idx(l), weight(w) { }
+  // std::priority_queue is a max-heap, so order by descending end
+  bool operator<(const ReadEnd &o) const { return end > o.end; }
 };
 
-typedef deque< SeqRead > read_deque;
+typedef priority_queue< ReadEnd > read_end_heap;
 
+// sweeps along one chromosome/strand: a read's weight is added to the
+// running length sums at its start and subtracted again at its end, so
+// the length vector only changes at read starts/ends and each stretch
+// in between is written as a single run
 class WeightedReadLengthCoverageComputer {
-  read_deque q;
+  read_end_heap ends;
   string chr;
-  int front_pos;
-  ostream &os;
+  int front_pos;            // everything before this bp has been written
+  LengthVectorWriter &out;
   int min_length, max_length, length_range;
   char strand;
 
+  vector<double> length_sums;   // summed weights of live reads per length
+  vector<int> length_counts;    // number of live reads per length
+  vector<float> lengths;        // output buffer
+
+  void advance(int pos);
+
 public:
-  WeightedReadLengthCoverageComputer(const string &chr, ostream &o, int minlen, int maxlen, char str) :
-    q(), chr(chr), front_pos(0), os(o), min_length(minlen), max_length(maxlen), length_range(1+maxlen-minlen),
-    strand(str) { }
+  WeightedReadLengthCoverageComputer(const string &chr, LengthVectorWriter &o, int minlen, int maxlen, char str) :
+    ends(), chr(chr), front_pos(0), out(o), min_length(minlen), max_length(maxlen), length_range(1+maxlen-minlen),
+    strand(str), length_sums(length_range, 0.0), length_counts(length_range, 0),
+    lengths(length_range, 0.0) { }
 
   void process_read(int start, int length, float weight);
   void finish();
 };
 
+// write the length vectors of all bp before pos
+void WeightedReadLengthCoverageComputer::advance(int pos) {
+  while (front_pos < pos && !ends.empty()) {
+    // the length vector is constant until the next read ends
+    int next_pos = min(pos, ends.top().end);
+    if (next_pos > front_pos) {
+      for(int i=0; i < length_range; ++i)
+	lengths[i] = length_sums[i];
+      out.write(chr, strand, front_pos, next_pos, lengths);
+      front_pos = next_pos;
+    }
+
+    // retire the reads that end here
+    while (!ends.empty() && ends.top().end <= front_pos) {
+      const ReadEnd &e = ends.top();
+      length_sums[e.length_idx] -= e.weight;
+      // reset exactly so rounding never leaves a phantom count behind
+      if (--length_counts[e.length_idx] == 0)
+	length_sums[e.length_idx] = 0;
+      ends.pop();
+    }
+  }
+  // nothing is covered up to pos
+  if (front_pos < pos)
+    front_pos = pos;
+}
+
 void WeightedReadLengthCoverageComputer::process_read(int start, int length,
 						float weight) {
-  if (q.empty())
-    front_pos = start;
-  
-  //cout << "\tfront pos: " << front_pos << "\n";
-  //cout << "\tread: " << Read(start,length,weight) << "\n";
-  
-  // read at pos > front
-  while(front_pos < start) {
-    vector<float> length_sums(length_range, 0.0);
-    float sum(0);
-
-    for(read_deque::iterator p=q.begin(); p != q.end(); ++p) {
-      if(p->length >= min_length && p->length <= max_length) {
-	length_sums[p->length - min_length] += p->weight;   // accumulate wgt at this pos and length
-	sum += p->weight;
-      }
+  advance(start);
+
+  // reads outside the length range do not contribute
+  if (length < min_length || length > max_length)
+    return;
+
+  int l = length - min_length;
+  length_sums[l] += weight;   // accumulate wgt at this length
+  ++length_counts[l];
+  ends.push( ReadEnd(start + length, l, weight) );
+}
+
+void WeightedReadLengthCoverageComputer::finish() {
+  advance(INT_MAX);
+}
+
+
+// how the length vectors are written
+struct OutputFormat {
+  bool binary, runs;
+  int min_length, max_length;
+};
+
+LengthVectorWriter *open_writer(const string &fn, const OutputFormat &fmt) {
+  int n_lengths = 1 + fmt.max_length - fmt.min_length;
+  if (fmt.binary) {
+    LengthVectorBinaryWriter *w =
+      new LengthVectorBinaryWriter(fn, fmt.min_length, n_lengths);
+    if (w->is_open())
+      return w;
+    delete w;
+  } else {
+    LengthVectorTextWriter *w = new LengthVectorTextWriter(fn, fmt.runs);
+    if (w->is_open())
+      return w;
+    delete w;
+  }
+  cerr << "Failed to open file for writing: " << fn << "\n";
+  return NULL;
+}
+
+// hand an alignment to the computer for its strand
+void process_alignment(const bam1_t *b, WeightedReadLengthCoverageComputer *pwc[2]) {
+  int strand = ((b->core.flag & 0x0010) > 0);
+  int read_start = b->core.pos;
+  int read_len = b->core.l_qseq;
+
+  //uint8_t *aux_data = bam_aux_get(b, "XW");
+  //float read_weight = bam_aux2f( aux_data );
+  float read_weight = 1.0/float( bam_aux2i(bam_aux_get(b, "NH")));
+
+  pwc[strand]->process_read( read_start, read_len, read_weight );
+}
+
+char strand_name[2] = {'+', '-'};
+
+////////////////////////////////////////////////////////////////
+// threaded mode: each worker takes the next reference, reads its
+// alignments through the BAM index and writes them to temporary files,
+// which are then appended to the outputs in header order
+
+struct ThreadedRun {
+  const char *bam_fn;
+  const bam_index_t *idx;
+  const bam_header_t *hdr;
+  OutputFormat fmt;
+  vector<string> tmp_fns[2];  // per reference; empty if no alignments
+  int next_tid;
+  bool failed;
+  pthread_mutex_t lock;
+};
+
+string tmp_filename(const string &out_fn, int tid) {
+  ostringstream fn;
+  fn << out_fn << ".tid" << tid << ".tmp";
+  return fn.str();
+}
 
-      --(p->remaining_length);
-      if (p->remaining_length == 0)
-	p->weight = 0;    // nullify weight when no length remaining
+void *lenvec_worker(void *data) {
+  ThreadedRun *run = (ThreadedRun *) data;
+  bamFile fp = bam_open(run->bam_fn, "r");
+  if (fp == 0) {
+    cerr << "Failed to open BAM file " << run->bam_fn << "\n";
+    pthread_mutex_lock(&run->lock);
+    run->failed = true;
+    pthread_mutex_unlock(&run->lock);
+    return NULL;
+  }
+  bam1_t *b = bam_init1();
+
+  while (true) {
+    pthread_mutex_lock(&run->lock);
+    int tid = run->failed ? run->hdr->n_targets : run->next_tid++;
+    pthread_mutex_unlock(&run->lock);
+    if (tid >= run->hdr->n_targets)
+      break;
+
+    string chr_name(run->hdr->target_name[tid]);
+    LengthVectorWriter *writers[2] = {NULL, NULL};
+    WeightedReadLengthCoverageComputer *pwc[2] = {NULL, NULL};
+    bool opened[2] = {false, false};
+    bool ok = true;
+
+    bam_iter_t iter = bam_iter_query(run->idx, tid, 0, run->hdr->target_len[tid]);
+    while (ok && bam_iter_read(fp, iter, b) >= 0) {
+      // only create output files for references with alignments
+      if (pwc[0] == NULL) {
+	for(int i=0; i < 2; ++i) {
+	  writers[i] = open_writer(run->tmp_fns[i][tid], run->fmt);
+	  opened[i] = writers[i] != NULL;
+	  ok = ok && opened[i];
+	}
+	if (!ok)
+	  break;
+	for(int i=0; i < 2; ++i)
+	  pwc[i] = new WeightedReadLengthCoverageComputer(chr_name, *writers[i],
+							  run->fmt.min_length,
+							  run->fmt.max_length,
+							  strand_name[i]);
+      }
+      process_alignment(b, pwc);
     }
-    // output length vector for this pos
-    if (sum > 0) {
-      os << chr << "\t" << strand << "\t" << front_pos;
-      for(int i=0; i < length_range; ++i)
-	os << "\t" << length_sums[i];
-      os << "\n";
+    bam_iter_destroy(iter);
+
+    for(int i=0; i < 2; ++i) {
+      if (pwc[i]) {
+	pwc[i]->finish();
+	delete pwc[i];
+      }
+      if (writers[i]) {
+	writers[i]->close();
+	delete writers[i];
+      }
     }
-    
-    ++front_pos;
-  }
-  
-  // clean out dead entries
-  while((!q.empty()) && q.front().weight == 0) {
-    q.pop_front();
-    //cout << "pop_front\n";
+
+    pthread_mutex_lock(&run->lock);
+    if (!ok)
+      run->failed = true;
+    // keep the names of the files that were created, so that they are
+    // removed even if the other strand's could not be
+    for(int i=0; i < 2; ++i)
+      if (!opened[i])
+	run->tmp_fns[i][tid].clear();
+    pthread_mutex_unlock(&run->lock);
   }
-  
-  // add new entry
 
-  q.push_back( SeqRead(weight, length) );
-  //cout << "push_back (" << weight << "," << length << ")\n";  
+  bam_destroy1(b);
+  bam_close(fp);
+  return NULL;
 }
 
-void WeightedReadLengthCoverageComputer::finish() {
-  if (!q.empty())
-    process_read(front_pos + q.back().remaining_length, 1, 1);
-}
+int compute_threaded(const char *bam_fn, char **out_fns,
+		     const OutputFormat &fmt, int n_threads) {
+  bam_index_t *idx = bam_index_load(bam_fn);
+  if (idx == 0) {
+    cerr << "Failed to load the index of " << bam_fn
+	 << " (run samtools index first)\n";
+    return 1;
+  }
+  bamFile fp;
+  if ((fp = bam_open(bam_fn, "r")) == 0) {
+    cerr << "Failed to open BAM file " << bam_fn << "\n";
+    return 1;
+  }
+  bam_header_t *hdr = bam_header_read(fp);
+  bam_close(fp);
 
+  ThreadedRun run;
+  run.bam_fn = bam_fn;
+  run.idx = idx;
+  run.hdr = hdr;
+  run.fmt = fmt;
+  for(int i=0; i < 2; ++i)
+    for(int tid=0; tid < hdr->n_targets; ++tid)
+      run.tmp_fns[i].push_back(tmp_filename(out_fns[i], tid));
+  run.next_tid = 0;
+  run.failed = false;
+  pthread_mutex_init(&run.lock, NULL);
+
+  // the workers share one queue of references, so fewer threads than
+  // asked for still do all the work
+  vector<pthread_t> threads(n_threads);
+  int n_started = 0;
+  while (n_started < n_threads &&
+	 pthread_create(&threads[n_started], NULL, lenvec_worker, &run) == 0)
+    ++n_started;
+  if (n_started == 0) {
+    cerr << "Failed to start any threads\n";
+    run.failed = true;
+  } else if (n_started < n_threads)
+    cerr << "Warning: started only " << n_started << " of " << n_threads
+	 << " threads\n";
+  for(int t=0; t < n_started; ++t)
+    pthread_join(threads[t], NULL);
+  pthread_mutex_destroy(&run.lock);
+
+  // merge the per-reference files in header order
+  int ret = run.failed ? 1 : 0;
+  for(int i=0; i < 2 && ret == 0; ++i) {
+    LengthVectorWriter *out = open_writer(out_fns[i], fmt);
+    if (out == NULL) {
+      ret = 1;
+      break;
+    }
+    out->write_header(fmt.min_length, 1 + fmt.max_length - fmt.min_length);
+    for(int tid=0; tid < hdr->n_targets; ++tid) {
+      const string &tmp_fn = run.tmp_fns[i][tid];
+      if (tmp_fn.empty())
+	continue;
+      if (i == 0) {
+	cout << hdr->target_name[tid] << "... ";
+	cout.flush();
+      }
+      if (!out->append(tmp_fn)) {
+	cerr << "Failed to merge " << tmp_fn << " into " << out_fns[i] << "\n";
+	ret = 1;
+	break;
+      }
+    }
+    out->close();
+    delete out;
+  }
+  cout << "\n";
+
+  for(int i=0; i < 2; ++i)
+    for(int tid=0; tid < hdr->n_targets; ++tid)
+      if (!run.tmp_fns[i][tid].empty())
+	unlink(run.tmp_fns[i][tid].c_str());
+
+  bam_header_destroy(hdr);
+  bam_index_destroy(idx);
+  return ret;
+}
 
 int main(int argc, char **argv) {
 
-  if (argc < 6) {
-    cerr << "USAGE: " << argv[0] << " in.bam outplus outminus min_len max_len\n";
+  OutputFormat fmt;
+  fmt.binary = false;
+  fmt.runs = false;
+  int n_threads = 0;
+  int n_inflate_threads = 0;
+
+  static struct option long_options[] = {
+    {"threads", required_argument, 0, 't'},
+    {"inflate-threads", required_argument, 0, 'd'},
+    {0, 0, 0, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "brt:d:", long_options, NULL)) >= 0) {
+    switch (c) {
+    case 'b': fmt.binary = true; break;
+    case 'r': fmt.runs = true; break;
+    case 't': n_threads = atoi(optarg); break;
+    case 'd': n_inflate_threads = atoi(optarg); break;
+    default: return 1;
+    }
+  }
+  if (argc - optind < 5) {
+    cerr << "USAGE: " << argv[0] << " [-b|-r] [-t threads|-d threads] in.bam outplus outminus min_len max_len\n"
+	 << "  -b  write the binary (block-compressed) lenvector format\n"
+	 << "  -r  write text with one line per run of identical length vectors\n"
+	 << "  -t, --threads N\n"
+	 << "      process chromosomes on N threads (needs a sorted, indexed BAM)\n"
+	 << "  -d, --inflate-threads N\n"
+	 << "      read the BAM in one pass, decompressing it on N threads (not with -t)\n";
     return 1;
   }
 
-  int min_length(atoi(argv[4]));
-  int max_length(atoi(argv[5]));
+  const char *bam_fn = argv[optind];
+  char **out_fns = argv + optind + 1;   // [plus, minus]
+  fmt.min_length = atoi(argv[optind+3]);
+  fmt.max_length = atoi(argv[optind+4]);
+
+  // threaded mode reads each reference through the index on its own
+  // thread, and has no single stream to decompress ahead
+  if (n_threads > 0 && n_inflate_threads > 0) {
+    cerr << "-t and -d cannot be combined\n";
+    return 1;
+  }
+  if (n_threads > 0)
+    return compute_threaded(bam_fn, out_fns, fmt, n_threads);
 
   // open BAM file
   bamFile fp;
   bam_header_t *hdr;
-  if ((fp = bam_open(argv[1], "r")) == 0) {
-    cerr << "Failed to open BAM file " << argv[1] << "\n";
+  if ((fp = bam_open(bam_fn, "r")) == 0) {
+    cerr << "Failed to open BAM file " << bam_fn << "\n";
     return 1;
   }
+  if (n_inflate_threads > 0 && bgzf_mt(fp, n_inflate_threads, 0) != 0)
+    cerr << "Warning: could not start inflate threads, reading on one\n";
 
   // open output files
-  ofstream out_files[2];   // [plus, minus]
+  LengthVectorWriter *writers[2];   // [plus, minus]
   for(int i=0; i < 2; ++i ) {
-    out_files[i].open(argv[2+i]);
-    if (!out_files[i].is_open() ) {
-      cerr << "Failed to open file for writing: " << argv[2+i] << "\n";
+    writers[i] = open_writer(out_fns[i], fmt);
+    if (writers[i] == NULL)
       return 1;
-    }
+    writers[i]->write_header(fmt.min_length, 1 + fmt.max_length - fmt.min_length);
   }
 
   hdr = bam_header_read(fp);
@@ -149,18 +419,10 @@ int main(int argc, char **argv) {
   int prev_ref(-1);   // BAM ID of reference sequence (chromosome)
 
   string chr_name;
-  char strand_name[2] = {'+', '-'};
 
   while(bam_read1(fp, b) > 0) {
 
     int curr_ref = b->core.tid;
-    int strand = ((b->core.flag & 0x0010) > 0);
-    int read_start = b->core.pos;
-    int read_len = b->core.l_qseq;
-
-    //uint8_t *aux_data = bam_aux_get(b, "XW");
-    //float read_weight = bam_aux2f( aux_data );
-    float read_weight = 1.0/float( bam_aux2i(bam_aux_get(b, "NH")));
 
     if (curr_ref != prev_ref) {
       // finished chromosome, so dump the queue and close the files
@@ -175,12 +437,12 @@ int main(int argc, char **argv) {
       cout << chr_name << "... ";
       cout.flush();
       for(int i=0; i < 2; ++i)
-	pwc[i] = new WeightedReadLengthCoverageComputer(chr_name, out_files[i],
-							min_length, max_length,
+	pwc[i] = new WeightedReadLengthCoverageComputer(chr_name, *writers[i],
+							fmt.min_length, fmt.max_length,
 							strand_name[i]);
     }
 
-    pwc[strand]->process_read( read_start, read_len, read_weight );
+    process_alignment(b, pwc);
 
     prev_ref = curr_ref;
   }
@@ -190,9 +452,12 @@ int main(int argc, char **argv) {
     for(int i=0; i < 2; ++i) {
       pwc[i]->finish();
       delete pwc[i];
-      out_files[i].close();
     }
   }
+  for(int i=0; i < 2; ++i) {
+    writers[i]->close();
+    delete writers[i];
+  }
 
   cout << "\n";
 
@@ -0,0 +1,100 @@
+//  Copyright (c) 2013 University of Pennsylvania
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+
+
+// compute the entropy of the 5' and 3' read positions of each locus
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <unistd.h>
+#include "sam.h"
+#include "locus.h"
+
+using namespace std;
+
+bool verbose = true;
+
+struct EntropyState {
+  BEDEntry locus;
+  PositionHistogram pos5p, pos3p;
+};
+
+int add_read_ends(const bam1_t *b, void *data) {
+  EntropyState *state = (EntropyState *)data;
+  if (is_sense(b, state->locus)) {
+    int five_p, three_p;
+    read_ends(b, five_p, three_p);
+    state->pos5p.add(five_p);
+    state->pos3p.add(three_p);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int cache_mb = 16;
+  int c;
+  while ((c = getopt(argc, argv, "c:")) >= 0) {
+    switch (c) {
+    case 'c': cache_mb = atoi(optarg); break;
+    default: return 1;
+    }
+  }
+  if (argc - optind < 2 || cache_mb < 0 || cache_mb > 1024) {
+    cerr << "USAGE: " << argv[0] << " [-c cache_mb] loci_bed in.bam\n"
+	 << "  -c  MB of inflated BAM blocks kept for neighbouring loci (16)\n";
+    return 1;
+  }
+  string bed_fn(argv[optind]);
+  const char *bam_fn = argv[optind+1];
+
+  ifstream bed_file(bed_fn.c_str());
+  if (!bed_file.is_open()) {
+    cerr << "Could not open BED file " << bed_fn << "\n";
+    return 1;
+  }
+
+  LocusBam bam;
+  if (!bam.open(bam_fn, cache_mb << 20))
+    return 1;
+
+  cout << "name\tpos_entropy5p\tpos_entropy3p\n";
+
+  EntropyState state;
+  string line, prev_chr;
+  while(getline(bed_file, line)) {
+    parse_bed_line(line, state.locus);
+    const BEDEntry &locus = state.locus;
+    if (verbose && locus.chr != prev_chr)
+      cerr << locus.chr << "... ";
+    prev_chr = locus.chr;
+
+    state.pos5p.reset(locus.start);
+    state.pos3p.reset(locus.start);
+    bam.fetch(locus, &state, add_read_ends);
+
+    cout << locus.name << "\t" << state.pos5p.entropy()
+	 << "\t" << state.pos3p.entropy() << "\n";
+  }
+  if (verbose)
+    cerr << "\n";
+  return 0;
+}
@@ -0,0 +1,450 @@
+//  Copyright (c) 2013 University of Pennsylvania
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+
+// compute the read-based features of all loci in one indexed pass over
+// the BAM file, reading each read once however many loci it overlaps:
+// read counts, antisense, position entropy, nucleotide frequencies and
+// length vectors. With -b, the same loci are computed for a list of BAM
+// files (one sample each), several at a time
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "sam.h"
+#include "locus.h"
+
+using namespace std;
+
+bool verbose = true;
+
+// everything accumulated over the reads of one locus
+struct LocusReads {
+  int sense_reads, antisense_reads;
+  double nuc_counts[4];
+  PositionHistogram pos5p, pos3p;
+  vector<double> lenvec_sum;
+
+  LocusReads(size_t n_lengths) : lenvec_sum(n_lengths) { }
+
+  void clear(const BEDEntry &locus) {
+    sense_reads = antisense_reads = 0;
+    for(int i=0; i < 4; ++i)
+      nuc_counts[i] = 0;
+    pos5p.reset(locus.start);
+    pos3p.reset(locus.start);
+    fill(lenvec_sum.begin(), lenvec_sum.end(), 0.0);
+  }
+};
+
+void add_read(LocusReads &acc, const BEDEntry &locus, const bam1_t *b,
+	      int min_read_len) {
+  if (!is_sense(b, locus)) {
+    ++acc.antisense_reads;
+    return;
+  }
+  ++acc.sense_reads;
+  count_bases(b, acc.nuc_counts);
+  int five_p, three_p;
+  read_ends(b, five_p, three_p);
+  acc.pos5p.add(five_p);
+  acc.pos3p.add(three_p);
+  add_read_length(acc.lenvec_sum, min_read_len, locus, b->core.pos,
+		  b->core.l_qseq, read_weight(b));
+}
+
+// the output files, named as by the feature_*.sh scripts
+struct FeatureFiles {
+  ofstream cov, antisense, entropy, nuc, lengths;
+
+  bool open(const string &dir) {
+    cov.open((dir + "/loci.cov").c_str());
+    antisense.open((dir + "/feat_antisense.txt").c_str());
+    entropy.open((dir + "/feat_posentropy.txt").c_str());
+    nuc.open((dir + "/feat_nuc.txt").c_str());
+    lengths.open((dir + "/feat_lengths.txt").c_str());
+    return cov.is_open() && antisense.is_open() && entropy.is_open() &&
+      nuc.is_open() && lengths.is_open();
+  }
+};
+
+// a locus' row in each feature file, kept until all loci are done so
+// that the rows can be written in BED order
+struct LocusRows {
+  string cov, antisense, entropy, nuc, lengths;
+};
+
+void format_locus(LocusRows &rows, const BEDEntry &locus, const string &bed_line,
+		  LocusReads &acc, int antisense_min_reads) {
+  ostringstream cov, antisense, entropy, nuc, lengths;
+  cov << bed_line << "\t" << acc.sense_reads << "\n";
+  antisense << locus.name << "\t"
+	    << (acc.antisense_reads >= antisense_min_reads ? 1 : 0) << "\n";
+  entropy << locus.name << "\t" << acc.pos5p.entropy()
+	  << "\t" << acc.pos3p.entropy() << "\n";
+  write_nuc_feature(nuc, locus, acc.nuc_counts);
+  write_lenvec_feature(lengths, locus, acc.lenvec_sum);
+  rows.cov = cov.str();
+  rows.antisense = antisense.str();
+  rows.entropy = entropy.str();
+  rows.nuc = nuc.str();
+  rows.lengths = lengths.str();
+}
+
+void write_locus(FeatureFiles &out, const LocusRows &rows) {
+  out.cov << rows.cov;
+  out.antisense << rows.antisense;
+  out.entropy << rows.entropy;
+  out.nuc << rows.nuc;
+  out.lengths << rows.lengths;
+}
+
+// the loci, parsed once and shared by all samples
+struct Loci {
+  vector<BEDEntry> entries;
+  vector<string> lines;
+};
+
+struct FeatureParams {
+  int min_read_len, max_read_len;
+  int antisense_min_reads;
+};
+
+// the accumulators of the loci that reads are being added to; a locus
+// is finished once the reads have moved past its end, and accumulators
+// are reused from locus to locus
+class ActiveLoci {
+public:
+  ActiveLoci(const Loci &loci, const vector<int> &tids,
+	     const FeatureParams &params, vector<LocusRows> &rows)
+    : loci(loci), tids(tids), params(params), rows(rows),
+      accs(loci.entries.size(), (LocusReads *)0), finished(loci.entries.size(), false) { }
+
+  ~ActiveLoci() {
+    for(size_t i=0; i < pool.size(); ++i)
+      delete pool[i];
+  }
+
+  void add_read(int locus_i, const bam1_t *b) {
+    LocusReads *&acc = accs[locus_i];
+    if (acc == 0) {
+      if (free_accs.empty()) {
+	pool.push_back(new LocusReads(1 + params.max_read_len - params.min_read_len));
+	free_accs.push_back(pool.back());
+      }
+      acc = free_accs.back();
+      free_accs.pop_back();
+      acc->clear(loci.entries[locus_i]);
+      active.push_back(locus_i);
+    }
+    ::add_read(*acc, loci.entries[locus_i], b, params.min_read_len);
+  }
+
+  // finish the loci that end at or before pos on tid, or lie on another
+  // reference
+  void finish_before(int tid, int pos) {
+    size_t n = 0;
+    for(size_t i=0; i < active.size(); ++i) {
+      int l = active[i];
+      if (tids[l] == tid && loci.entries[l].end > size_t(pos))
+	active[n++] = l;
+      else
+	finish(l);
+    }
+    active.resize(n);
+  }
+
+  // finish the remaining loci, including those without reads
+  void finish_all() {
+    for(size_t i=0; i < active.size(); ++i)
+      finish(active[i]);
+    active.clear();
+    LocusReads empty(1 + params.max_read_len - params.min_read_len);
+    for(size_t l=0; l < finished.size(); ++l) {
+      if (finished[l])
+	continue;
+      empty.clear(loci.entries[l]);
+      format_locus(rows[l], loci.entries[l], loci.lines[l], empty,
+		   params.antisense_min_reads);
+      finished[l] = true;
+    }
+  }
+
+private:
+  void finish(int l) {
+    format_locus(rows[l], loci.entries[l], loci.lines[l], *accs[l],
+		 params.antisense_min_reads);
+    finished[l] = true;
+    free_accs.push_back(accs[l]);
+    accs[l] = 0;
+  }
+
+  const Loci &loci;
+  const vector<int> &tids;
+  const FeatureParams &params;
+  vector<LocusRows> &rows;
+  vector<LocusReads *> accs;      // of each locus, while it is active
+  vector<bool> finished;
+  vector<int> active;
+  vector<LocusReads *> pool, free_accs;
+};
+
+int compute_sample_features(const Loci &loci, const FeatureParams &params,
+			    const char *bam_fn, const string &out_dir,
+			    bool verbose) {
+  LocusBam bam;
+  if (!bam.open(bam_fn))
+    return 1;
+
+  FeatureFiles out;
+  if (!out.open(out_dir)) {
+    cerr << "Failed to open output files in " << out_dir << "\n";
+    return 1;
+  }
+  out.antisense << "name\tantisense\n";
+  out.entropy << "name\tpos_entropy5p\tpos_entropy3p\n";
+  out.nuc << "name\tnuc_A\tnuc_C\tnuc_G\tnuc_T\n";
+  write_lenvec_header(out.lengths, params.min_read_len,
+		      1 + params.max_read_len - params.min_read_len);
+
+  // one query for all loci: overlapping loci share the chunks they
+  // read, and every read is dispatched to all loci it overlaps
+  size_t n_loci = loci.entries.size();
+  vector<int> tids(n_loci, -1), begs(n_loci), ends(n_loci);
+  for(size_t i=0; i < n_loci; ++i) {
+    const BEDEntry &locus = loci.entries[i];
+    tids[i] = bam.tid(locus.chr);
+    begs[i] = locus.start;
+    ends[i] = locus.end;
+  }
+  vector<LocusRows> rows(n_loci);
+  ActiveLoci active(loci, tids, params, rows);
+  bam1_t *b = bam_init1();
+  if (n_loci > 0) {
+    bam_miter_t iter = bam_miter_query(bam.idx, n_loci, &tids[0], &begs[0], &ends[0]);
+    const int *hits;
+    int n_hits, prev_tid = -1;
+    while (bam_miter_read(bam.fp, iter, b, &hits, &n_hits) >= 0) {
+      if (verbose && b->core.tid != prev_tid)
+	cerr << bam.hdr->target_name[b->core.tid] << "... ";
+      prev_tid = b->core.tid;
+      active.finish_before(b->core.tid, b->core.pos);
+      for(int i=0; i < n_hits; ++i)
+	active.add_read(hits[i], b);
+    }
+    bam_miter_destroy(iter);
+  }
+  active.finish_all();
+  for(size_t i=0; i < n_loci; ++i)
+    write_locus(out, rows[i]);
+  if (verbose)
+    cerr << "\n";
+
+  bam_destroy1(b);
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////
+// batch mode
+
+// one BAM file of a batch; its features go to out_dir/name
+struct Sample {
+  string bam_fn;
+  string name;
+};
+
+// the list has one BAM file per line, optionally followed by a sample
+// name (default: the file name without directory and .bam). Sample names
+// must be unique, as each names an output directory
+bool read_sample_list(const string &fn, vector<Sample> &samples) {
+  ifstream in(fn.c_str());
+  if (!in.is_open()) {
+    cerr << "Could not open BAM list " << fn << "\n";
+    return false;
+  }
+  map<string, string> sample_bams;
+  string line;
+  while(getline(in, line)) {
+    istringstream fields(line);
+    Sample sample;
+    if (!(fields >> sample.bam_fn) || sample.bam_fn[0] == '#')
+      continue;
+    fields >> sample.name;
+    if (sample.name.empty()) {
+      size_t slash = sample.bam_fn.rfind('/');
+      sample.name = sample.bam_fn.substr(slash == string::npos ? 0 : slash+1);
+      if (sample.name.size() > 4 &&
+	  sample.name.compare(sample.name.size()-4, 4, ".bam") == 0)
+	sample.name.erase(sample.name.size()-4);
+    }
+    map<string, string>::const_iterator prev = sample_bams.find(sample.name);
+    if (prev != sample_bams.end()) {
+      cerr << "Sample name " << sample.name << " of " << sample.bam_fn
+	   << " is already used by " << prev->second
+	   << "; give the samples distinct names in " << fn << "\n";
+      return false;
+    }
+    sample_bams[sample.name] = sample.bam_fn;
+    samples.push_back(sample);
+  }
+  return true;
+}
+
+// the samples are handed out to the worker threads one at a time
+struct BatchState {
+  const Loci *loci;
+  const FeatureParams *params;
+  const vector<Sample> *samples;
+  string out_dir;
+  size_t next_sample;
+  int n_failed;
+  pthread_mutex_t lock;
+};
+
+void *sample_worker(void *arg) {
+  BatchState *state = (BatchState *)arg;
+  while (true) {
+    pthread_mutex_lock(&state->lock);
+    size_t i = state->next_sample++;
+    pthread_mutex_unlock(&state->lock);
+    if (i >= state->samples->size())
+      break;
+    const Sample &sample = (*state->samples)[i];
+    string sample_dir = state->out_dir + "/" + sample.name;
+    int ret;
+    if (mkdir(sample_dir.c_str(), 0777) != 0 && errno != EEXIST) {
+      pthread_mutex_lock(&state->lock);
+      cerr << "Could not create " << sample_dir << ": " << strerror(errno) << "\n";
+      pthread_mutex_unlock(&state->lock);
+      ret = 1;
+    } else
+      ret = compute_sample_features(*state->loci, *state->params,
+				    sample.bam_fn.c_str(), sample_dir, false);
+    pthread_mutex_lock(&state->lock);
+    if (ret != 0)
+      ++state->n_failed;
+    else if (verbose)
+      cerr << sample.name << " done\n";
+    pthread_mutex_unlock(&state->lock);
+  }
+  return NULL;
+}
+
+int compute_batch_features(const Loci &loci, const FeatureParams &params,
+			   const vector<Sample> &samples, const string &out_dir,
+			   int n_threads) {
+  BatchState state;
+  state.loci = &loci;
+  state.params = &params;
+  state.samples = &samples;
+  state.out_dir = out_dir;
+  state.next_sample = 0;
+  state.n_failed = 0;
+  pthread_mutex_init(&state.lock, NULL);
+
+  n_threads = max(1, min(n_threads, int(samples.size())));
+  // the workers share one queue of samples, so fewer threads than
+  // asked for still process all of them
+  vector<pthread_t> threads(n_threads);
+  int n_started = 0;
+  while (n_started < n_threads &&
+	 pthread_create(&threads[n_started], NULL, sample_worker, &state) == 0)
+    ++n_started;
+  if (n_started < n_threads && n_started > 0)
+    cerr << "Warning: started only " << n_started << " of " << n_threads
+	 << " threads\n";
+  for(int i=0; i < n_started; ++i)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&state.lock);
+
+  if (n_started == 0) {
+    cerr << "Failed to start any threads\n";
+    return 1;
+  }
+
+  if (state.n_failed > 0) {
+    cerr << state.n_failed << " of " << samples.size() << " samples failed\n";
+    return 1;
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv) {
+  FeatureParams params;
+  params.antisense_min_reads = 2;
+  string sample_list_fn;
+  int n_threads = 1;
+  int c;
+  while ((c = getopt(argc, argv, "a:b:t:")) >= 0) {
+    switch (c) {
+    case 'a': params.antisense_min_reads = atoi(optarg); break;
+    case 'b': sample_list_fn = optarg; break;
+    case 't': n_threads = atoi(optarg); break;
+    default: return 1;
+    }
+  }
+  bool batch = !sample_list_fn.empty();
+  if (argc - optind < (batch ? 4 : 5)) {
+    cerr << "USAGE: " << argv[0]
+	 << " [-a antisense_min_reads] loci_bed in.bam min_read_len max_read_len out_dir\n"
+	 << "       " << argv[0]
+	 << " [-a antisense_min_reads] [-t threads] -b bam_list loci_bed min_read_len max_read_len out_dir\n"
+	 << "  writes loci.cov, feat_antisense.txt, feat_posentropy.txt,\n"
+	 << "  feat_nuc.txt and feat_lengths.txt to out_dir, or with -b to\n"
+	 << "  out_dir/sample for every line \"in.bam [sample]\" of bam_list\n";
+    return 1;
+  }
+  string bed_fn(argv[optind++]);
+  const char *bam_fn = batch ? 0 : argv[optind++];
+  params.min_read_len = atoi(argv[optind]);
+  params.max_read_len = atoi(argv[optind+1]);
+  string out_dir(argv[optind+2]);
+
+  ifstream bed_file(bed_fn.c_str());
+  if (!bed_file.is_open()) {
+    cerr << "Could not open BED file " << bed_fn << "\n";
+    return 1;
+  }
+  Loci loci;
+  string line;
+  while(getline(bed_file, line)) {
+    loci.entries.push_back(BEDEntry());
+    parse_bed_line(line, loci.entries.back());
+    loci.lines.push_back(line);
+  }
+
+  if (!batch)
+    return compute_sample_features(loci, params, bam_fn, out_dir, verbose);
+
+  vector<Sample> samples;
+  if (!read_sample_list(sample_list_fn, samples))
+    return 1;
+  return compute_batch_features(loci, params, samples, out_dir, n_threads);
+}
@@ -27,75 +27,159 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <algorithm>
 #include <cstdlib>
 #include <cmath>
+#include <getopt.h>
+#include "sam.h"
+#include "lenvec.h"
+#include "locus.h"
 
 using namespace std;
 
 bool verbose = true;
 
-// a vector of read length counts at a genomic bp
-struct LengthVector {
-  string chr, strand;
-  size_t bp;
-  vector<int> data;
+////////////////////////////////////////////////////////////////
+// --bam mode: the reads of the sorted BAM file are merge-joined with
+// the loci of each chromosome (sorted by start), so no genome-wide
+// length vectors are needed
+
+// loci of one chromosome, in order of start, that the sweep has reached
+// but not yet passed
+struct ChrLoci {
+  vector<size_t> by_start;   // indices into the BED entries
+  size_t next;               // first locus not yet active
+  vector<size_t> active;
 };
 
-// parse a line from a genomic lenvector file
-//   load_data=false to only read chr,strand (for indexing)
-void parse_lenvec_line(const string &line, LengthVector& result, 
-		      bool load_data=true) {
-  result.data.clear();
-  istringstream line_str(line);
-  getline(line_str, result.chr, '\t');
-  getline(line_str, result.strand, '\t');
-  string bp_s;
-  getline(line_str, bp_s, '\t');
-  result.bp = atol(bp_s.c_str());
-  if (load_data) {
-    string s;
-    while(getline(line_str, s, '\t'))
-      result.data.push_back(atol(s.c_str()));
+int compute_from_bam(const string &bed_fn, const char *bam_fn,
+		     int min_read_len, int max_read_len) {
+  vector<BEDEntry> loci;
+  ifstream bed_file(bed_fn.c_str());
+  if (!bed_file.is_open()) {
+    cerr << "Could not open BED file " << bed_fn << "\n";
+    return(1);
+  }
+  string line;
+  while(getline(bed_file, line)) {
+    loci.push_back(BEDEntry());
+    parse_bed_line(line, loci.back());
   }
-}
 
-struct BEDEntry {
-  string chr;
-  size_t start, end;
-  string name;
-  int score;
-  string strand;
-};
-void parse_bed_line(const string &line, BEDEntry &result) {
-  istringstream line_str(line);
-  getline(line_str, result.chr, '\t');
-  string s;
-  getline(line_str, s, '\t');
-  result.start = atol(s.c_str());
-  getline(line_str, s, '\t');
-  result.end = atol(s.c_str());
-  getline(line_str, result.name, '\t');
-  getline(line_str, s, '\t');
-  // NOTE: assumes score is integer
-  result.score = atoi(s.c_str());
-  getline(line_str, result.strand, '\t');
+  bamFile fp;
+  if ((fp = bam_open(bam_fn, "r")) == 0) {
+    cerr << "Failed to open BAM file " << bam_fn << "\n";
+    return(1);
+  }
+  bam_header_t *hdr = bam_header_read(fp);
+  map<string, int> chr_tids;
+  for(int i=0; i < hdr->n_targets; ++i)
+    chr_tids[hdr->target_name[i]] = i;
+
+  vector<ChrLoci> chr_loci(hdr->n_targets);
+  for(size_t i=0; i < loci.size(); ++i) {
+    map<string, int>::const_iterator tid = chr_tids.find(loci[i].chr);
+    if (tid != chr_tids.end())
+      chr_loci[tid->second].by_start.push_back(i);
+  }
+  for(size_t t=0; t < chr_loci.size(); ++t) {
+    vector<pair<size_t, size_t> > starts;
+    for(size_t i=0; i < chr_loci[t].by_start.size(); ++i)
+      starts.push_back(make_pair(loci[chr_loci[t].by_start[i]].start,
+				 chr_loci[t].by_start[i]));
+    sort(starts.begin(), starts.end());
+    for(size_t i=0; i < starts.size(); ++i)
+      chr_loci[t].by_start[i] = starts[i].second;
+    chr_loci[t].next = 0;
+  }
+
+  size_t n_lengths = 1 + max_read_len - min_read_len;
+  vector< vector<double> > lenvec_sums(loci.size(), vector<double>(n_lengths, 0));
+
+  bam1_t *b = bam_init1();
+  int prev_tid = -1;
+  int prev_pos = 0;
+  while (bam_read1(fp, b) >= 0) {
+    if (b->core.flag & BAM_FUNMAP || b->core.tid < 0)
+      continue;
+    if (b->core.tid != prev_tid) {
+      if (verbose)
+	cerr << hdr->target_name[b->core.tid] << "... ";
+      prev_tid = b->core.tid;
+      prev_pos = 0;
+    }
+    if (b->core.pos < prev_pos) {
+      cerr << "\nBAM file " << bam_fn << " is not sorted by position\n";
+      return(1);
+    }
+    prev_pos = b->core.pos;
+
+    ChrLoci &cl = chr_loci[b->core.tid];
+    size_t read_start = b->core.pos;
+    size_t read_end = read_start + b->core.l_qseq;
+    // activate the loci starting before the read ends, and retire those
+    // ending before it starts (reads come in order of start)
+    while (cl.next < cl.by_start.size() &&
+	   loci[cl.by_start[cl.next]].start < read_end)
+      cl.active.push_back(cl.by_start[cl.next++]);
+    size_t n_active = 0;
+    for(size_t i=0; i < cl.active.size(); ++i) {
+      const BEDEntry &locus = loci[cl.active[i]];
+      if (locus.end <= read_start)
+	continue;
+      cl.active[n_active++] = cl.active[i];
+      if (is_sense(b, locus))
+	add_read_length(lenvec_sums[cl.active[i]], min_read_len, locus,
+			read_start, b->core.l_qseq, read_weight(b));
+    }
+    cl.active.resize(n_active);
+  }
+  if (verbose)
+    cerr << "\n";
+  bam_destroy1(b);
+  bam_header_destroy(hdr);
+  bam_close(fp);
+
+  write_lenvec_header(cout, min_read_len, n_lengths);
+  for(size_t i=0; i < loci.size(); ++i)
+    write_lenvec_feature(cout, loci[i], lenvec_sums[i]);
+  return(0);
 }
 
+////////////////////////////////////////////////////////////////
+
 int main(int argc, char **argv) {
-  if (argc < 4) {
+  bool from_bam = false;
+  static struct option long_options[] = {
+    {"bam", no_argument, 0, 'B'},
+    {0, 0, 0, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "", long_options, NULL)) >= 0) {
+    switch (c) {
+    case 'B': from_bam = true; break;
+    default: return(1);
+    }
+  }
+  if (argc - optind < (from_bam ? 4 : 3)) {
     cerr << "USAGE: " << argv[0]
-	 << " locus_bed lenvector_prefix min_read_len\n";
+	 << " locus_bed lenvector_prefix min_read_len\n"
+	 << "       " << argv[0]
+	 << " --bam locus_bed in.bam min_read_len max_read_len\n";
     return(1);
   }
 
-  string bed_fn(argv[1]);
-  // length vector filenames
-  string lv_fn[2] = {string(argv[2]) + ".plus",
-		     string(argv[2]) + ".minus"};
-  string lvidx_fn[2] = {lv_fn[0] + ".idx",
-			lv_fn[1] + ".idx"};
+  string bed_fn(argv[optind]);
+  if (from_bam)
+    return compute_from_bam(bed_fn, argv[optind+1], atoi(argv[optind+2]),
+			    atoi(argv[optind+3]));
 
-  int min_read_len(atoi(argv[3]));
+  // length vector filenames; either the text format (with .idx files
+  // from index_genomic_lenvectors) or the binary format
+  string lv_fn[2] = {string(argv[optind+1]) + ".plus",
+		     string(argv[optind+1]) + ".minus"};
+
+  int min_read_len(atoi(argv[optind+2]));
 
   ifstream bed_file(bed_fn.c_str());
   if (!bed_file.is_open()) {
@@ -104,161 +188,59 @@ int main(int argc, char **argv) {
   }
   
   // open lenvec files
-  ifstream lv_files[2];
-  for(int i=0; i < 2; ++i) {
-    lv_files[i].open(lv_fn[i].c_str());
-    if (!lv_files[i].is_open()) {
-      cerr << "Could not open lenvector file " << lv_fn[i] << "\n";
-      return(1);
-    }
-  }
-  // open lenvec chromosome indices (lets us seek to a chromsome in O(1) time)
-  ifstream lvidx_files[2];
+  LengthVectorReader *lv_readers[2];
   for(int i=0; i < 2; ++i) {
-    lvidx_files[i].open(lvidx_fn[i].c_str());
-    if (!lvidx_files[i].is_open()) {
-      cerr << "Could not find index file " << lvidx_fn[i] << "\n";
+    lv_readers[i] = open_lenvec_reader(lv_fn[i]);
+    if (!lv_readers[i]->good()) {
+      cerr << lv_readers[i]->error_message() << "\n";
       return(1);
     }
   }
 
-  // build chromosome indices with key "chr;strand"
-  // note: this is a std::map but accesses will be infrequent
-  map<string, size_t> chr_strand_idx;
-  string line;
-  for (int i=0; i < 2; ++i) {
-    char strand = ( (i == 0) ? '+' : '-' );
-    while(getline(lvidx_files[i], line)) {
-      istringstream line_str(line);
-      string key;
-      getline(line_str, key, '\t');
-      key += string(";") + strand;
-      
-      string field;
-      getline(line_str, field, '\t');
-      size_t pos = atol(field.c_str());
-      
-      chr_strand_idx[key] = pos;
-    }
-  }
-
-  // the intrachromsomal index maps genomic bp to byte in the lenvector file
-  // we build this at runtime
-  map<size_t, size_t> intra_chr_idx;
-  // index every N bp;
-  // lower = faster lookups+more mem usage
-  size_t intra_chr_idx_stride = 100;
-  
   size_t n_lengths = 0; // size of length vectors
 
-  // this assumes chromsome_strands are contiguous
-  // in the BED file; if not, it will be slower
+  // the BED file need not be sorted; the readers keep their
+  // per-chromosome indexes
+  string line;
   string prev_chr_strand;
   while(getline(bed_file, line)) {
     BEDEntry bed;
     parse_bed_line(line, bed);
 
-    ifstream &lv_file = (bed.strand == "+") ? lv_files[0] : lv_files[1];
+    LengthVectorReader *lv_reader = (bed.strand == "+") ? lv_readers[0] : lv_readers[1];
     
     string chr_strand(bed.chr + ";" + bed.strand);
     if (chr_strand != prev_chr_strand) {
-      // we've encountered a new chr_strand, so build the intra_chr index
       if (verbose)
 	cerr << chr_strand << "... ";
 
-      intra_chr_idx.clear();
-      if (chr_strand_idx.find(chr_strand) == chr_strand_idx.end()) {
-	cerr << "Could not find start position for " << chr_strand << " in index!\n";
-	return(1);
-      }
-      size_t chr_strand_start = chr_strand_idx[chr_strand];
-
-      lv_file.seekg(chr_strand_start);
-      string lv_line;
-      LengthVector lenvec;
-      size_t prev_lv_pos = chr_strand_start;
-      size_t prev_lv_bp=0;
-      while(getline(lv_file, lv_line)) {
-	parse_lenvec_line(lv_line, lenvec, false);
-	// stop if we hit another chr_strand
-	if ( (lenvec.chr + ";" + lenvec.strand) != chr_strand)
-	  break;
-	// record the curr position if the stride has elapsed
-	if (prev_lv_bp == 0 ||
-	    (lenvec.bp >= (prev_lv_bp+intra_chr_idx_stride)))
-	  intra_chr_idx[lenvec.bp] = prev_lv_pos;
-	prev_lv_bp = lenvec.bp;
-	// track beginning of the following line
-	prev_lv_pos = lv_file.tellg();
-      }
-      lv_file.clear(); // clear eof flag just in case
+      // e.g. all reads there are shorter or longer than the lengths
+      // counted; such loci get the features of zero sums
+      if (!lv_reader->has(bed.chr, bed.strand))
+	cerr << "Warning: no length vectors for " << chr_strand << "\n";
     }
 
-    // intra_chr index is built, so use it
-    // find the first position occurring before our query pos
-    map<size_t, size_t>::iterator it = intra_chr_idx.upper_bound(bed.start);
-    if (it != intra_chr_idx.begin())
-      --it;
-    lv_file.seekg(it->second);
-    //if (verbose) {
-    //  cerr << "Locus at " << bed.start << ": found "
-    //	   << it->first << "/" << it->second << "\n";
-    //}
-    vector<double> lenvec_sum(n_lengths, 0);
-    while(getline(lv_file, line)) {
-      LengthVector lenvec;
-      parse_lenvec_line(line, lenvec);
-      if (n_lengths == 0) {
-	n_lengths = lenvec.data.size();
-	lenvec_sum.resize(n_lengths, 0);
-
-	// print header
-	cout << "name";
-	for(size_t i=0; i < n_lengths; ++i)
-	  cout << "\tE" << (min_read_len+i);
-	cout << "\n";
-      }
+    if (n_lengths == 0) {
+      n_lengths = lv_reader->num_lengths();
 
-      // skip positions before the locus start
-      if (lenvec.bp < bed.start)
-	continue;
-      // stop when we pass the locus' end
-      if (lenvec.bp >= bed.end)
-	break;
-
-      // accumulate sum
-      for(size_t i=0; i < n_lengths; ++i)
-	lenvec_sum[i] += lenvec.data[i];
-    } // for each lenvec line
-    lv_file.clear(); // clear eof flag just in case
-
-    // normalize sum by locus length
-    double row_sum(0);
-    for(size_t i=0; i < n_lengths; ++i) {
-      lenvec_sum[i] /= double(bed.end-bed.start); // count per bp
-      ++lenvec_sum[i];   // laplace smoothing
-      row_sum += lenvec_sum[i];
+      write_lenvec_header(cout, min_read_len, n_lengths);
     }
 
-    double expected_prob = 1.0/double(lenvec_sum.size());
-
-    // print output
-
-    cout << bed.name;
-
-    for(size_t i=0; i < n_lengths; ++i) {
-      // convert to probability
-      lenvec_sum[i] /= row_sum;
-      // convert to log2 odds ratio versus expected probability
-      lenvec_sum[i] = log2(lenvec_sum[i] / expected_prob);
-      cout << "\t" << lenvec_sum[i];
+    vector<double> lenvec_sum(n_lengths, 0);
+    if (!lv_reader->sum(bed.chr, bed.strand, bed.start, bed.end, lenvec_sum)) {
+      cerr << "Failed to read length vectors for " << bed.name << "\n";
+      return(1);
     }
-    cout << "\n";
+
+    write_lenvec_feature(cout, bed, lenvec_sum);
 
     prev_chr_strand = chr_strand;
   } // for each bed line
   if (verbose)
     cerr << "\n";
 
+  for(int i=0; i < 2; ++i)
+    delete lv_readers[i];
+
   return(0);
 }
@@ -0,0 +1,299 @@
+//  Copyright (c) 2013 University of Pennsylvania
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+
+// compute the minimum free energy of the (sense strand) sequence of each
+// locus; the sequences are read with faidx and folded in batches by a
+// pool of RNAfold processes
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <pthread.h>
+#include "faidx.h"
+#include "locus.h"
+
+using namespace std;
+
+bool verbose = true;
+
+// sequence lengths from the .fai index, to clip the loci to
+bool read_fai_lengths(const string &fa_fn, map<string, int> &chr_lens) {
+  ifstream fai_file((fa_fn + ".fai").c_str());
+  if (!fai_file.is_open())
+    return false;
+  string line, chr;
+  while(getline(fai_file, line)) {
+    FieldTokenizer fields(line);
+    const char *b = line.data(), *e = b;
+    fields.next(chr);
+    fields.next(b, e);
+    chr_lens[chr] = parse_long(b, e);
+  }
+  return true;
+}
+
+void reverse_complement(string &seq) {
+  static char complement[256];
+  if (complement['A'] == 0) {
+    for(int i=0; i < 256; ++i)
+      complement[i] = i;
+    const char *from = "ACGTUNacgtun", *to = "TGCAANtgcaan";
+    for(int i=0; from[i]; ++i)
+      complement[(unsigned char)from[i]] = to[i];
+  }
+  reverse(seq.begin(), seq.end());
+  for(size_t i=0; i < seq.size(); ++i)
+    seq[i] = complement[(unsigned char)seq[i]];
+}
+
+// the sequence of a locus on its strand, clipped to the chromosome;
+// false (with the reason in error) if there is none to fold
+bool locus_sequence(faidx_t *fai, const map<string, int> &chr_lens,
+		    const BEDEntry &locus, string &seq, string &error) {
+  map<string, int>::const_iterator len = chr_lens.find(locus.chr);
+  if (len == chr_lens.end()) {
+    error = locus.chr + " is not in the genome";
+    return false;
+  }
+  int end = min(int(locus.end), len->second);
+  if (int(locus.start) >= end) {
+    error = "it lies outside " + locus.chr;
+    return false;
+  }
+  int n;
+  char *s = faidx_fetch_seq(fai, const_cast<char *>(locus.chr.c_str()),
+			    locus.start, end - 1, &n);
+  if (s == 0 || n <= 0) {
+    free(s);
+    error = "it could not be read from the genome";
+    return false;
+  }
+  seq.assign(s, n);
+  free(s);
+  if (locus.strand == "-")
+    reverse_complement(seq);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////
+// folding
+
+struct FoldState {
+  const vector<string> *seqs;
+  vector<string> *mfes;
+  string fold_cmd;
+  string tmp_dir;
+  size_t batch_size;
+  size_t next_batch;
+  bool failed;
+  pthread_mutex_t lock;
+};
+
+// the energy of an RNAfold structure line, "((...)). ( -1.20)"
+string parse_energy(const string &line) {
+  size_t open = line.rfind('('), close = line.rfind(')');
+  if (open == string::npos || close == string::npos || close < open)
+    return "";
+  string energy;
+  for(size_t i=open+1; i < close; ++i)
+    if (line[i] != ' ')
+      energy += line[i];
+  return energy;
+}
+
+// fold the sequences [first,last) with one RNAfold process
+bool fold_batch(FoldState *state, size_t first, size_t last) {
+  const vector<string> &seqs = *state->seqs;
+  string tmp_fn = state->tmp_dir + "/coral_mfe.XXXXXX";
+  int fd = mkstemp(&tmp_fn[0]);
+  if (fd < 0) {
+    cerr << "Could not create a temporary file in " << state->tmp_dir << "\n";
+    return false;
+  }
+  FILE *tmp = fdopen(fd, "w");
+  if (tmp == 0) {
+    cerr << "Could not write temporary file " << tmp_fn << "\n";
+    close(fd);
+    unlink(tmp_fn.c_str());
+    return false;
+  }
+  for(size_t i=first; i < last; ++i) {
+    fputs(seqs[i].c_str(), tmp);
+    fputc('\n', tmp);
+  }
+  if (fclose(tmp) != 0) {
+    cerr << "Could not write temporary file " << tmp_fn << "\n";
+    unlink(tmp_fn.c_str());
+    return false;
+  }
+
+  string cmd = state->fold_cmd + " < " + tmp_fn;
+  FILE *out = popen(cmd.c_str(), "r");
+  if (out == 0) {
+    cerr << "Could not run " << state->fold_cmd << "\n";
+    unlink(tmp_fn.c_str());
+    return false;
+  }
+  // two lines per sequence: the sequence and its structure
+  size_t n_seqs = last - first, n_lines = 0;
+  string line;
+  char buf[4096];
+  while (fgets(buf, sizeof(buf), out)) {
+    line += buf;
+    if (line.empty() || line[line.size()-1] != '\n')
+      continue;
+    if (n_lines % 2 == 1 && n_lines/2 < n_seqs)
+      (*state->mfes)[first + n_lines/2] = parse_energy(line);
+    ++n_lines;
+    line.clear();
+  }
+  bool ok = pclose(out) == 0 && n_lines == 2*n_seqs;
+  if (!ok)
+    cerr << state->fold_cmd << " failed on " << tmp_fn << "\n";
+  unlink(tmp_fn.c_str());
+  return ok;
+}
+
+void *fold_worker(void *arg) {
+  FoldState *state = (FoldState *)arg;
+  size_t n_seqs = state->seqs->size();
+  while (true) {
+    pthread_mutex_lock(&state->lock);
+    size_t first = state->next_batch * state->batch_size;
+    ++state->next_batch;
+    bool stop = state->failed;
+    pthread_mutex_unlock(&state->lock);
+    if (stop || first >= n_seqs)
+      break;
+    size_t last = min(first + state->batch_size, n_seqs);
+    bool ok = fold_batch(state, first, last);
+    pthread_mutex_lock(&state->lock);
+    if (!ok)
+      state->failed = true;
+    else if (verbose)
+      cerr << last << " of " << n_seqs << " loci folded\n";
+    pthread_mutex_unlock(&state->lock);
+  }
+  return NULL;
+}
+
+////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv) {
+  int n_threads = 1;
+  size_t batch_size = 500;
+  string fold_cmd("RNAfold --noPS");
+  int c;
+  while ((c = getopt(argc, argv, "t:b:f:")) >= 0) {
+    switch (c) {
+    case 't': n_threads = atoi(optarg); break;
+    case 'b': batch_size = atoi(optarg); break;
+    case 'f': fold_cmd = optarg; break;
+    default: return 1;
+    }
+  }
+  if (argc - optind < 2 || batch_size == 0) {
+    cerr << "USAGE: " << argv[0]
+	 << " [-t threads] [-b batch_size] [-f fold_cmd] loci_bed genome.fa\n"
+	 << "  -t  number of folding processes run at once (1)\n"
+	 << "  -b  loci per folding process (500)\n"
+	 << "  -f  folding command, reading one sequence per line (\"RNAfold --noPS\")\n";
+    return 1;
+  }
+  string bed_fn(argv[optind]);
+  string fa_fn(argv[optind+1]);
+
+  ifstream bed_file(bed_fn.c_str());
+  if (!bed_file.is_open()) {
+    cerr << "Could not open BED file " << bed_fn << "\n";
+    return 1;
+  }
+  faidx_t *fai = fai_load(fa_fn.c_str());
+  map<string, int> chr_lens;
+  if (fai == 0 || !read_fai_lengths(fa_fn, chr_lens)) {
+    cerr << "Failed to load the FASTA index of " << fa_fn << "\n";
+    return 1;
+  }
+
+  // a locus without a sequence means that the loci and the genome do
+  // not match; report them all rather than give them an energy
+  vector<string> names, seqs;
+  string line, error;
+  size_t n_missing = 0;
+  while(getline(bed_file, line)) {
+    BEDEntry locus;
+    parse_bed_line(line, locus);
+    names.push_back(locus.name);
+    seqs.push_back("");
+    if (!locus_sequence(fai, chr_lens, locus, seqs.back(), error)) {
+      cerr << "No sequence for locus " << locus.name << " (" << locus.chr
+	   << ":" << locus.start << "-" << locus.end << "): " << error << "\n";
+      ++n_missing;
+    }
+  }
+  fai_destroy(fai);
+  if (n_missing > 0) {
+    cerr << n_missing << " of " << names.size() << " loci have no sequence in "
+	 << fa_fn << "\n";
+    return 1;
+  }
+
+  vector<string> mfes(seqs.size());
+  FoldState state;
+  state.seqs = &seqs;
+  state.mfes = &mfes;
+  state.fold_cmd = fold_cmd;
+  state.tmp_dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+  state.batch_size = batch_size;
+  state.next_batch = 0;
+  state.failed = false;
+  pthread_mutex_init(&state.lock, NULL);
+
+  n_threads = max(1, n_threads);
+  // the workers share one queue of batches, so fewer threads than asked
+  // for still fold all of them
+  vector<pthread_t> threads(n_threads);
+  int n_started = 0;
+  while (n_started < n_threads &&
+	 pthread_create(&threads[n_started], NULL, fold_worker, &state) == 0)
+    ++n_started;
+  if (n_started == 0) {
+    cerr << "Failed to start any threads\n";
+    state.failed = true;
+  } else if (n_started < n_threads)
+    cerr << "Warning: started only " << n_started << " of " << n_threads
+	 << " threads\n";
+  for(int i=0; i < n_started; ++i)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&state.lock);
+  if (state.failed)
+    return 1;
+
+  cout << "name\tmfe\n";
+  for(size_t i=0; i < names.size(); ++i)
+    cout << names[i] << "\t" << mfes[i] << "\n";
+  return 0;
+}
@@ -1,4 +1,4 @@
-#!/usr/bin/env ruby
+#!/bin/bash
 #  Copyright (c) 2013 University of Pennsylvania
 #
 #  Permission is hereby granted, free of charge, to any person obtaining a 
@@ -19,43 +19,29 @@
 #  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
 #  DEALINGS IN THE SOFTWARE.
 
-# for each locus compute the entropy of the read positions given an input of:
-# locus   5p/3p   count
-
-if ARGV.size < 1
-  $stderr.puts "USAGE: #{$0} entropy_input"
-  exit 1
-end
-
-infn = ARGV.shift
-
-Locus = Struct.new(:name, :counts5p, :counts3p)
-
-loci = Hash.new
-File.open(infn).each_line do |line|
-  name, which, count = line.chomp.split(/\t/)
-  loci[name] ||= Locus.new(name, [], [])
-  if which == "5p"
-    loci[name].counts5p << count.to_i
-  else
-    loci[name].counts3p << count.to_i
-  end
-end
-
-class Array
-  def sum
-    self.inject(0) { |a,x| a + x }
-  end
-end
-
-puts "name\tpos_entropy5p\tpos_entropy3p"
-
-loci.sort.each do |name, locus|
-  count5p_sum = locus.counts5p.sum.to_f
-  count3p_sum = locus.counts5p.sum.to_f
-  probs5p = locus.counts5p.map { |x| x.to_f / count5p_sum }
-  probs3p = locus.counts3p.map { |x| x.to_f / count3p_sum }
-  entropy5p = -( probs5p.map { |prob| prob*Math.log(prob) }.sum )
-  entropy3p = -( probs3p.map { |prob| prob*Math.log(prob) }.sum )
-  puts "#{name}\t#{entropy5p}\t#{entropy3p}"
-end
+
+# compute the read-based features of one shared locus set for many
+# samples in one run; bam_list has one sorted, indexed bam per line,
+# optionally followed by a sample name (default: the bam file name
+# without .bam; names must be unique). The features of each sample go
+# to out_dir/<sample>, named as by feature_all.sh
+
+if [ $# -lt 4 ]; then
+    echo "USAGE: $0 bam_list loci_bed config_file out_dir" >&2
+    exit 1
+fi
+
+bam_list=$1
+loci=$2
+config=$3
+outdir=$4
+
+source $config
+
+mkdir -p $outdir
+
+###
+echo "Computing locus features for all samples..." >&2
+
+compute_locus_features -a $antisense_min_reads -t ${threads:-1} \
+  -b $bam_list $loci $min_trimmed_read_len $max_trimmed_read_len $outdir
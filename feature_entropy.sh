@@ -37,26 +37,6 @@ mkdir -p $outdir
 
 ##
 # NOTE: requires sorted indexed bam
-echo "Computing locus read positions..." >&2
-rm ${outdir}/locus_readpos.counts
-while read line; do
-  reg=$(echo $line | awk '{print $1":"($2-1)"-"$3}')
-  strand=$(echo $line | awk '{print $6}')
-  id=$(echo $line | awk '{print $4}')
-  echo $id"..." >&2
-  samtools view $bam $reg | \
-    awk '("'$strand'" == "+" && (and($2, 16) == 0)) {
-           print "'$id'\t5p\t"($4-1)  
-           print "'$id'\t3p\t"($4-1+length($10))
-         }
-         ("'$strand'" == "-" && (and($2, 16) != 0)) {
-           print "'$id'\t5p\t"($4-1+length($10))
-           print "'$id'\t3p\t"($4-1)
-         } '
-done < ${outdir}/loci.bed | \
-  sort -k1,2 -k3n | uniq -c | \
-    awk '{print $2"\t"$3"\t"$1}' > ${outdir}/locus_readpos.counts
+echo "Computing locus read position entropy..." >&2
 
-compute_locus_entropy.rb ${outdir}/locus_readpos.counts > \
-  ${outdir}/feat_posentropy.txt
-   
+compute_locus_entropy ${outdir}/loci.bed $bam > ${outdir}/feat_posentropy.txt
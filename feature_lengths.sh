@@ -35,15 +35,43 @@ outdir=`dirname $bam`/coral
 mkdir -p $outdir
 
 ###
+if [ "$lenvec_format" == "bam" ]; then
+  # merge-join the sorted reads with the loci; no genome-wide vectors
+  echo "Computing locus length features..." >&2
+  compute_locus_lenvectors --bam $outdir/loci.bed $bam \
+    $min_trimmed_read_len $max_trimmed_read_len > $outdir/feat_lengths.txt
+  exit 0
+fi
+
 echo "Computing genomic length vectors..." >&2
 
-compute_genomic_lenvectors $bam $outdir/genomic_lenvec.plus \
-  $outdir/genomic_lenvec.minus $min_trimmed_read_len $max_trimmed_read_len
+# per-chromosome worker threads (needs an indexed bam)
+opts=""
+if [ -n "$threads" ] && [ "$threads" -gt 1 ]; then
+  opts="-t $threads"
+fi
 
-echo "Indexing genomic length vectors..." >&2
+if [ "$lenvec_format" == "binary" ]; then
+  # binary files carry their own block index
+  compute_genomic_lenvectors -b $opts $bam $outdir/genomic_lenvec.plus \
+    $outdir/genomic_lenvec.minus $min_trimmed_read_len $max_trimmed_read_len
+else
+  # one line per run of identical length vectors, or per bp
+  if [ "$lenvec_format" == "runs" ]; then
+    opts="$opts -r"
+  fi
+  compute_genomic_lenvectors $opts $bam $outdir/genomic_lenvec.plus \
+    $outdir/genomic_lenvec.minus $min_trimmed_read_len $max_trimmed_read_len
 
-index_genomic_lenvectors $outdir/genomic_lenvec.plus
-index_genomic_lenvectors $outdir/genomic_lenvec.minus
+  echo "Indexing genomic length vectors..." >&2
+
+  index_opts=""
+  if [ "$lenvec_cube" == "1" ]; then
+    index_opts="-c"
+  fi
+  index_genomic_lenvectors $index_opts $outdir/genomic_lenvec.plus
+  index_genomic_lenvectors $index_opts $outdir/genomic_lenvec.minus
+fi
 
 echo "Computing locus length features..." >&2
 
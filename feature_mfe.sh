@@ -20,7 +20,7 @@
 #  DEALINGS IN THE SOFTWARE.
 
 # compute minimum free energy at a locus
-# requires RNAfold and BEDtools
+# requires RNAfold
 
 if [ $# -lt 4 ]; then
   echo "USAGE: $0 inbam config_file genome_fas chromInfo" >&2
@@ -41,30 +41,7 @@ mkdir -p $outdir
 # NOTE: requires sorted indexed bam
 echo "Computing MFE..." >&2
 
-echo -e "name\tmfe" > ${outdir}/feat_mfe.txt
-
-# first force bed intervals to fit into chr boundaries
-# to placate fastaFromBed
-awk 'BEGIN{OFS="\t"; FS="\t"}
-     NR==FNR {chrlen[$1] = $2; next}
-     $2 < 0 { $2 = 0 }
-     $3 > chrlen[$1] { $3 = chrlen[$1] }
-     { print }
-' $chrominfo ${outdir}/loci.bed | \
-while read line; do
-  reg=$(echo $line | awk '{print $1":"($2-1)"-"$3}')
-  strand=$(echo $line | awk '{print $6}')
-  id=$(echo $line | awk '{print $4}')
-  echo $id"..." >&2
-  echo "$line" | \
-    fastaFromBed -s -fi $genome_fa -bed - -tab -fo /dev/stdout | \
-    cut -f2
-done | RNAfold | \
-  awk 'NR % 2 == 0' | \
-  sed -e 's/^[^ ]* [(]//; s/[)]$//; s/ //g' | \
-  paste <(cut -f4 ${outdir}/loci.bed ) - \
- >> ${outdir}/feat_mfe.txt
-
-
-
-   
+# the loci are clipped to the chromosome ends as given by the fasta
+# index, so chromInfo is no longer needed
+compute_locus_mfe -t ${threads:-1} ${outdir}/loci.bed $genome_fa \
+  > ${outdir}/feat_mfe.txt
@@ -42,43 +42,4 @@ mkdir -p $outdir
 # NOTE: requires sorted indexed bam
 echo "Computing nucleotide frequencies..." >&2
 
-echo -e "name\tnuc_A\tnuc_C\tnuc_G\tnuc_T" > ${outdir}/feat_nuc.txt
-
-cat ${outdir}/loci.bed | \
-while read line; do
-  reg=$(echo $line | awk '{print $1":"($2-1)"-"$3}')
-  strand=$(echo $line | awk '{print $6}')
-  id=$(echo $line | awk '{print $4}')
-  echo $id"..." >&2
-  samtools view $bam $reg | \
-    awk '("'$strand'" == "+" && (and($2, 16) == 0)) ||
-         ("'$strand'" == "-" && (and($2, 16) != 0)) {
-           print "'$id'\t"$10 } ' | sort | uniq -c
-done | \
-  awk 'function process_counts(locus) {
-         s = 4 + count["A"] + count["C"] + count["G"] + count["T"]
-         for(x in count) { count[x] = log( (count[x]/s) / 0.25 ) }
-         print locus,count["A"],count["C"],count["G"],count["T"]
-       }
-       function reset_counts() {
-         count["A"] = 1; count["C"] = 1
-         count["G"] = 1; count["T"] = 1
-       }
-       BEGIN{ OFS="\t"; reset_counts() }
-       {
-         curr_locus = $2
-         if (prev_locus && (curr_locus != prev_locus)) {
-           process_counts(prev_locus)
-           reset_counts()
-         }
-         gsub(/[^ACGT]/,"",$3)
-         split($3, a, "")
-         for(x in a) count[a[x]] += $1
-         prev_locus = curr_locus
-       }
-       END { process_counts(prev_locus) }' >> \
-  ${outdir}/feat_nuc.txt
-
-
-
-   
+compute_locus_nuc ${outdir}/loci.bed $bam > ${outdir}/feat_nuc.txt
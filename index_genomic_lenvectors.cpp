@@ -18,24 +18,39 @@
 //  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
 //  DEALINGS IN THE SOFTWARE.
 
-// index the length vector files by chromosome for faster access
+// index the length vector files for faster access: <file>.idx lists
+// the first line of each chromosome, <file>.lidx samples the lines of
+// each chromosome/strand every <stride> bp, and with -c <file>.cube
+// holds their prefix sums (see lenvec.h)
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <unistd.h>
+#include "lenvec.h"
 
 using namespace std;
 
 int main(int argc, char **argv) {
-
-  if (argc < 2) {
-    cerr << "USAGE: " << argv[0] << " lenvector_file\n";
+  uint32_t stride = LENVEC_OFFSET_INDEX_STRIDE;
+  bool make_cube = false;
+  int c;
+  while ((c = getopt(argc, argv, "s:c")) >= 0) {
+    switch (c) {
+    case 's': stride = atoi(optarg); break;
+    case 'c': make_cube = true; break;
+    default: return(1);
+    }
+  }
+  if (argc - optind < 1 || stride == 0) {
+    cerr << "USAGE: " << argv[0] << " [-s stride] [-c] lenvector_file\n";
     return(1);
   }
 
-  string in_fn(argv[1]);
+  string in_fn(argv[optind]);
   string out_fn(in_fn + ".idx");
 
   ifstream infile(in_fn.c_str());
@@ -49,21 +64,70 @@ int main(int argc, char **argv) {
     return(1);
   }
 
+  // the file size and mtime identify the indexed version of the file
+  LengthVectorFileStamp stamp;
+  if (!lenvec_file_stamp(in_fn, stamp)) {
+    cerr << "Could not stat input file " << in_fn << "\n";
+    return(1);
+  }
+
+  LengthVectorCubeWriter *cube = NULL;
+
   // assumes chromosomes are contiguous in the file
   string line;              // current line
   string prev_chr;          // previously read chromosome
-  size_t prev_filepos = 0;  // position in file before getline()
+  size_t filepos = 0;       // position in file before getline()
+  bool runs = false;
+  LengthVector lenvec;
+  vector<LengthVectorOffsets> seqs;
   while(getline(infile, line)) {
-    string chr;
-    istringstream iss(line);
-    getline(iss, chr, '\t');
+    size_t line_pos = filepos;
+    filepos += line.size() + 1;
+    // skip the header of run-collapsed files
+    if (line[0] == '#') {
+      runs = runs || is_lenvec_runs_header(line);
+      continue;
+    }
+
+    parse_lenvec_line(line, lenvec, runs, make_cube);
+    if (make_cube) {
+      if (cube == NULL) {
+	cube = new LengthVectorCubeWriter(in_fn + ".cube", lenvec.data.size(),
+					  stamp);
+	if (!cube->is_open()) {
+	  cerr << "Could not open output file " << in_fn << ".cube\n";
+	  return(1);
+	}
+      }
+      cube->add(lenvec);
+    }
 
     // output to the index on encountering a new chromosmoe
-    if (chr != prev_chr)
-      outfile << chr << "\t" << prev_filepos << "\n";
+    if (lenvec.chr != prev_chr)
+      outfile << lenvec.chr << "\t" << line_pos << "\n";
+
+    if (seqs.empty() || seqs.back().chr != lenvec.chr ||
+	seqs.back().strand != lenvec.strand[0]) {
+      seqs.push_back(LengthVectorOffsets());
+      seqs.back().chr = lenvec.chr;
+      seqs.back().strand = lenvec.strand[0];
+    }
+    seqs.back().sample(lenvec.bp, line_pos, stride);
+
+    prev_chr = lenvec.chr;
+  }
 
-    prev_filepos = infile.tellg();
-    prev_chr = chr;
+  if (cube) {
+    bool ok = cube->close();
+    delete cube;
+    if (!ok) {
+      cerr << "Could not write " << in_fn << ".cube\n";
+      return(1);
+    }
+  }
+  if (!write_lenvec_offset_index(in_fn + ".lidx", stride, stamp, seqs)) {
+    cerr << "Could not write offset index " << in_fn << ".lidx\n";
+    return(1);
   }
 
   return 0;
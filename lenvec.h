@@ -0,0 +1,1200 @@
+//  Copyright (c) 2013 University of Pennsylvania
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+
+// reading and writing genomic length vectors
+//
+// Length vectors are written as runs: consecutive bp with identical
+// length vectors share one [start,end) record.  On-disk formats:
+//   text:   one tab-separated line per covered bp
+//             chr  strand  bp  count_minlen ... count_maxlen
+//   runs:   a "#chr strand start end E<len>..." header, then one
+//           tab-separated line per run (bedGraph-like, multi-column)
+//             chr  strand  start  end  count_minlen ... count_maxlen
+//   binary: per chr/strand blocks of runs, each block zlib-compressed
+//           and laid out column-wise (all starts, all ends, then the
+//           counts for each read length), followed by a block index and
+//           a footer pointing at it.  See LengthVectorBinaryWriter.
+
+#ifndef CORAL_LENVEC_H
+#define CORAL_LENVEC_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <sstream>
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "tokenizer.h"
+
+// a vector of read length counts at genomic bp [bp,end)
+struct LengthVector {
+  std::string chr, strand;
+  size_t bp, end;
+  std::vector<float> data;
+};
+
+// true if a text lenvector header line announces the run format
+inline bool is_lenvec_runs_header(const std::string &line) {
+  static const std::string prefix("#chr\tstrand\tstart\tend");
+  return line.compare(0, prefix.size(), prefix) == 0;
+}
+
+// parse a line from a text genomic lenvector file
+//   runs=true for run-collapsed files (with an end column)
+//   load_data=false to only read chr,strand,bp,end (for indexing)
+inline void parse_lenvec_line(const char *begin, const char *end,
+			      LengthVector& result, bool runs=false,
+			      bool load_data=true) {
+  result.data.clear();
+  FieldTokenizer fields(begin, end);
+  fields.next(result.chr);
+  fields.next(result.strand);
+  const char *b = begin, *e = begin;
+  fields.next(b, e);
+  result.bp = parse_long(b, e);
+  result.end = result.bp + 1;
+  if (runs && fields.next(b, e))
+    result.end = parse_long(b, e);
+  if (load_data)
+    while(fields.next(b, e))
+      result.data.push_back(parse_double(b, e));
+}
+
+inline void parse_lenvec_line(const std::string &line, LengthVector& result,
+			      bool runs=false, bool load_data=true) {
+  parse_lenvec_line(line.data(), line.data() + line.size(), result, runs,
+		    load_data);
+}
+
+// receives the length vectors of covered bp, in order, and collapses
+// adjacent bp with identical vectors into runs
+class LengthVectorWriter {
+  // pending run, extended while the following bp carry the same vector
+  std::string run_chr;
+  char run_strand;
+  size_t run_start, run_end;
+  std::vector<float> run_lengths;
+
+protected:
+  virtual void write_run(const std::string &chr, char strand,
+			 size_t start, size_t end,
+			 const std::vector<float> &lengths) = 0;
+
+  void flush_run() {
+    if (run_end > run_start)
+      write_run(run_chr, run_strand, run_start, run_end, run_lengths);
+    run_start = run_end = 0;
+  }
+
+public:
+  LengthVectorWriter() : run_strand(0), run_start(0), run_end(0) { }
+  virtual ~LengthVectorWriter() { }
+
+  // the length vector is the same for all bp in [start,end)
+  void write(const std::string &chr, char strand, size_t start, size_t end,
+	     const std::vector<float> &lengths) {
+    if (start == run_end && run_end > run_start && strand == run_strand &&
+	lengths == run_lengths && chr == run_chr) {
+      run_end = end;
+      return;
+    }
+    flush_run();
+    run_chr = chr;
+    run_strand = strand;
+    run_start = start;
+    run_end = end;
+    run_lengths = lengths;
+  }
+  void write(const std::string &chr, char strand, size_t bp,
+	     const std::vector<float> &lengths) {
+    write(chr, strand, bp, bp+1, lengths);
+  }
+
+  // column header, for formats that have one
+  virtual void write_header(int min_len, int n_lengths) { }
+
+  virtual void close() { flush_run(); }
+
+  // append all records of another file of the same format (e.g. one
+  // written by a worker thread); returns false on error
+  virtual bool append(const std::string &fn) = 0;
+};
+
+// tab-separated formats: one line per bp (the original format),
+// or one line per run
+class LengthVectorTextWriter : public LengthVectorWriter {
+  std::ofstream file;  // when writing to a file of our own
+  std::ostream &os;
+  bool runs;
+
+protected:
+  void write_line(const std::string &chr, char strand, size_t bp,
+		  const size_t *end, const std::vector<float> &lengths) {
+    os << chr << "\t" << strand << "\t" << bp;
+    if (end)
+      os << "\t" << *end;
+    for(size_t i=0; i < lengths.size(); ++i)
+      os << "\t" << lengths[i];
+    os << "\n";
+  }
+
+  void write_run(const std::string &chr, char strand, size_t start,
+		 size_t end, const std::vector<float> &lengths) {
+    if (runs)
+      write_line(chr, strand, start, &end, lengths);
+    else
+      for(size_t bp=start; bp < end; ++bp)
+	write_line(chr, strand, bp, NULL, lengths);
+  }
+
+public:
+  LengthVectorTextWriter(std::ostream &o, bool r=false) : os(o), runs(r) { }
+  LengthVectorTextWriter(const std::string &fn, bool r=false) :
+    file(fn.c_str()), os(file), runs(r) { }
+  ~LengthVectorTextWriter() { close(); }
+
+  bool is_open() const { return &os != &file || file.is_open(); }
+
+  // the run format starts with a header naming the columns
+  void write_header(int min_len, int n_lengths) {
+    if (!runs)
+      return;
+    os << "#chr\tstrand\tstart\tend";
+    for(int i=0; i < n_lengths; ++i)
+      os << "\tE" << (min_len+i);
+    os << "\n";
+  }
+
+  bool append(const std::string &fn) {
+    flush_run();
+    std::ifstream in(fn.c_str());
+    if (!in.is_open())
+      return false;
+    if (in.peek() != EOF)
+      os << in.rdbuf();
+    return bool(os);
+  }
+};
+
+////////////////////////////////////////////////////////////////
+// binary format
+//
+//   header:  magic "CLVB", version, min_len, n_lengths     (4 x uint32)
+//   blocks:  zlib-compressed payload of n_records runs:
+//              uint32 start[n_records]
+//              uint32 end[n_records]
+//              float  count[n_lengths][n_records]
+//   index:   uint32 n_chrs, then per chr: uint32 name_len, name
+//            uint32 n_blocks, then per block: uint32 chr_id, char strand,
+//            uint32 start, end, n_records, uint64 offset,
+//            uint32 compressed_size
+//   footer:  uint64 index offset, magic "CLVI"
+
+static const char LENVEC_BINARY_MAGIC[4] = {'C','L','V','B'};
+static const char LENVEC_INDEX_MAGIC[4] = {'C','L','V','I'};
+static const uint32_t LENVEC_BINARY_VERSION = 3;
+// runs per block; bounds the memory needed to decompress one block
+static const uint32_t LENVEC_BLOCK_RECORDS = 4096;
+
+struct LengthVectorBlockInfo {
+  uint32_t chr_id;
+  char strand;
+  uint32_t start, end;   // bp covered by the block's runs
+  uint32_t n_records;
+  uint64_t offset;
+  uint32_t compressed_size;
+};
+
+// true if the file starts with the binary magic
+inline bool is_binary_lenvec_file(const std::string &fn) {
+  std::ifstream f(fn.c_str(), std::ios::binary);
+  char magic[4];
+  if (!f.read(magic, 4))
+    return false;
+  return memcmp(magic, LENVEC_BINARY_MAGIC, 4) == 0;
+}
+
+class LengthVectorBinaryWriter : public LengthVectorWriter {
+  std::ofstream out;
+  uint32_t min_len, n_lengths;
+  std::vector<std::string> chr_names;
+  std::map<std::string, uint32_t> chr_ids;
+  std::vector<LengthVectorBlockInfo> blocks;
+
+  // runs of the block being filled (row-major until flushed)
+  uint32_t curr_chr_id;
+  char curr_strand;
+  std::vector<uint32_t> curr_start, curr_end;
+  std::vector<float> curr_data;
+  std::vector<unsigned char> payload, compressed;
+  bool closed;
+
+  uint32_t chr_id(const std::string &chr) {
+    std::map<std::string, uint32_t>::iterator it = chr_ids.find(chr);
+    if (it != chr_ids.end())
+      return it->second;
+    uint32_t id = chr_names.size();
+    chr_names.push_back(chr);
+    chr_ids[chr] = id;
+    return id;
+  }
+
+  void put32(uint32_t x) { out.write((const char *) &x, sizeof(x)); }
+  void put64(uint64_t x) { out.write((const char *) &x, sizeof(x)); }
+
+  void flush_block() {
+    uint32_t n = curr_start.size();
+    if (n == 0)
+      return;
+    // transpose to column-major: starts, ends, then one column per length
+    payload.resize(2*sizeof(uint32_t)*n + sizeof(float)*n*n_lengths);
+    memcpy(&payload[0], &curr_start[0], sizeof(uint32_t)*n);
+    memcpy(&payload[sizeof(uint32_t)*n], &curr_end[0], sizeof(uint32_t)*n);
+    float *cols = (float *) &payload[2*sizeof(uint32_t)*n];
+    for(uint32_t r=0; r < n; ++r)
+      for(uint32_t l=0; l < n_lengths; ++l)
+	cols[l*n + r] = curr_data[r*n_lengths + l];
+
+    uLongf csize = compressBound(payload.size());
+    compressed.resize(csize);
+    if (compress2(&compressed[0], &csize, &payload[0], payload.size(),
+		  Z_DEFAULT_COMPRESSION) != Z_OK) {
+      std::cerr << "Failed to compress length vector block\n";
+      exit(1);
+    }
+
+    LengthVectorBlockInfo info;
+    memset(&info, 0, sizeof(info));
+    info.chr_id = curr_chr_id;
+    info.strand = curr_strand;
+    info.start = curr_start.front();
+    info.end = curr_end.back();
+    info.n_records = n;
+    info.offset = out.tellp();
+    info.compressed_size = csize;
+    blocks.push_back(info);
+
+    out.write((const char *) &compressed[0], csize);
+    curr_start.clear();
+    curr_end.clear();
+    curr_data.clear();
+  }
+
+protected:
+  void write_run(const std::string &chr, char strand, size_t start,
+		 size_t end, const std::vector<float> &lengths) {
+    uint32_t id = chr_id(chr);
+    if (id != curr_chr_id || strand != curr_strand ||
+	curr_start.size() >= LENVEC_BLOCK_RECORDS) {
+      flush_block();
+      curr_chr_id = id;
+      curr_strand = strand;
+    }
+    curr_start.push_back(start);
+    curr_end.push_back(end);
+    curr_data.insert(curr_data.end(), lengths.begin(), lengths.end());
+  }
+
+public:
+  LengthVectorBinaryWriter(const std::string &fn, int minlen, int nlen) :
+    out(fn.c_str(), std::ios::binary), min_len(minlen), n_lengths(nlen),
+    curr_chr_id(0), curr_strand(0), closed(false) {
+    out.write(LENVEC_BINARY_MAGIC, 4);
+    put32(LENVEC_BINARY_VERSION);
+    put32(min_len);
+    put32(n_lengths);
+  }
+  ~LengthVectorBinaryWriter() { close(); }
+
+  bool is_open() const { return out.is_open(); }
+
+  bool append(const std::string &fn);
+
+  void close() {
+    if (closed)
+      return;
+    closed = true;
+    flush_run();
+    flush_block();
+
+    uint64_t index_offset = out.tellp();
+    put32(chr_names.size());
+    for(size_t i=0; i < chr_names.size(); ++i) {
+      put32(chr_names[i].size());
+      out.write(chr_names[i].data(), chr_names[i].size());
+    }
+    put32(blocks.size());
+    for(size_t i=0; i < blocks.size(); ++i) {
+      const LengthVectorBlockInfo &info = blocks[i];
+      put32(info.chr_id);
+      out.write(&info.strand, 1);
+      put32(info.start);
+      put32(info.end);
+      put32(info.n_records);
+      put64(info.offset);
+      put32(info.compressed_size);
+    }
+    put64(index_offset);
+    out.write(LENVEC_INDEX_MAGIC, 4);
+    out.close();
+  }
+};
+
+// sums length vectors over genomic intervals of one lenvector file
+class LengthVectorReader {
+public:
+  virtual ~LengthVectorReader() { }
+  virtual bool good() const = 0;
+  virtual const std::string &error_message() const = 0;
+  virtual size_t num_lengths() = 0;
+  // true if the file has length vectors on chr/strand; reads of other
+  // lengths leave none, so a missing chr/strand just sums to zero
+  virtual bool has(const std::string &chr, const std::string &strand) = 0;
+  // add the length vectors of all bp in [start,end) to sums; a run
+  // counts once for every bp it shares with the interval. False only on
+  // a read error; a chr/strand without length vectors adds nothing
+  virtual bool sum(const std::string &chr, const std::string &strand,
+		   size_t start, size_t end, std::vector<double> &sums) = 0;
+};
+
+class LengthVectorBinaryReader : public LengthVectorReader {
+  std::ifstream in;
+  uint32_t min_len, n_lengths;
+  std::vector<std::string> chr_names;
+  std::vector<LengthVectorBlockInfo> blocks;
+  // block indices (in bp order) for each "chr;strand"
+  std::map<std::string, std::vector<size_t> > chr_strand_blocks;
+
+  // most recently decompressed block
+  size_t cached_block;
+  std::vector<unsigned char> compressed, payload;
+  std::string error;
+
+  uint32_t get32() {
+    uint32_t x = 0;
+    in.read((char *) &x, sizeof(x));
+    return x;
+  }
+  uint64_t get64() {
+    uint64_t x = 0;
+    in.read((char *) &x, sizeof(x));
+    return x;
+  }
+
+  bool load_block(size_t i) {
+    if (i == cached_block)
+      return true;
+    const LengthVectorBlockInfo &info = blocks[i];
+    compressed.resize(info.compressed_size);
+    in.clear();
+    in.seekg(info.offset);
+    if (!in.read((char *) &compressed[0], info.compressed_size))
+      return false;
+    uLongf size = 2*sizeof(uint32_t)*info.n_records +
+      sizeof(float)*info.n_records*n_lengths;
+    payload.resize(size);
+    if (uncompress(&payload[0], &size, &compressed[0],
+		   info.compressed_size) != Z_OK || size != payload.size())
+      return false;
+    cached_block = i;
+    return true;
+  }
+
+public:
+  LengthVectorBinaryReader(const std::string &fn) :
+    in(fn.c_str(), std::ios::binary), min_len(0), n_lengths(0),
+    cached_block(size_t(-1)) {
+    char magic[4];
+    if (!in.read(magic, 4) || memcmp(magic, LENVEC_BINARY_MAGIC, 4) != 0) {
+      error = "not a binary length vector file";
+      return;
+    }
+    if (get32() != LENVEC_BINARY_VERSION) {
+      error = "unsupported binary length vector version";
+      return;
+    }
+    min_len = get32();
+    n_lengths = get32();
+
+    // the footer points at the block index
+    const uint64_t header_size = 4 + 3*sizeof(uint32_t);
+    const uint64_t footer_size = sizeof(uint64_t) + 4;
+    in.seekg(0, std::ios::end);
+    uint64_t file_size = in.tellg();
+    if (!in || file_size < header_size + footer_size) {
+      error = "missing block index (truncated file?)";
+      return;
+    }
+    in.seekg(file_size - footer_size);
+    uint64_t index_offset = get64();
+    if (!in.read(magic, 4) || memcmp(magic, LENVEC_INDEX_MAGIC, 4) != 0) {
+      error = "missing block index (truncated file?)";
+      return;
+    }
+    if (index_offset < header_size || index_offset > file_size - footer_size) {
+      error = "corrupt block index offset";
+      return;
+    }
+    // every index entry is checked against the bytes it may occupy
+    uint64_t index_end = file_size - footer_size;
+    in.seekg(index_offset);
+    uint32_t n_chrs = get32();
+    if (!in || n_chrs > index_end - index_offset) {
+      error = "corrupt block index";
+      return;
+    }
+    chr_names.resize(n_chrs);
+    for(uint32_t i=0; i < n_chrs; ++i) {
+      uint32_t name_len = get32();
+      if (!in || name_len > index_end - uint64_t(in.tellg())) {
+	error = "corrupt block index";
+	return;
+      }
+      chr_names[i].resize(name_len);
+      if (name_len > 0)
+	in.read(&chr_names[i][0], name_len);
+    }
+    uint32_t n_blocks = get32();
+    const uint64_t block_info_size = 1 + 5*sizeof(uint32_t) + sizeof(uint64_t);
+    if (!in || n_blocks > (index_end - uint64_t(in.tellg())) / block_info_size) {
+      error = "corrupt block index";
+      return;
+    }
+    blocks.resize(n_blocks);
+    for(size_t i=0; i < blocks.size(); ++i) {
+      LengthVectorBlockInfo &info = blocks[i];
+      info.chr_id = get32();
+      in.read(&info.strand, 1);
+      info.start = get32();
+      info.end = get32();
+      info.n_records = get32();
+      info.offset = get64();
+      info.compressed_size = get32();
+      if (!in) {
+	error = "failed to read block index";
+	return;
+      }
+      // blocks lie between the header and the index
+      if (info.chr_id >= n_chrs || info.n_records > LENVEC_BLOCK_RECORDS ||
+	  info.offset < header_size || info.offset > index_offset ||
+	  info.compressed_size > index_offset - info.offset) {
+	error = "corrupt block index entry";
+	return;
+      }
+      std::string key(chr_names[info.chr_id] + ";" + info.strand);
+      chr_strand_blocks[key].push_back(i);
+    }
+  }
+
+  bool good() const { return error.empty(); }
+  const std::string &error_message() const { return error; }
+  size_t num_lengths() { return n_lengths; }
+  int min_length() const { return min_len; }
+
+  size_t num_blocks() const { return blocks.size(); }
+  const LengthVectorBlockInfo &block_info(size_t i) const { return blocks[i]; }
+  const std::string &chr_name(uint32_t id) const { return chr_names[id]; }
+
+  // the still-compressed bytes of block i
+  bool read_raw_block(size_t i, std::vector<unsigned char> &raw) {
+    raw.resize(blocks[i].compressed_size);
+    in.clear();
+    in.seekg(blocks[i].offset);
+    return bool(in.read((char *) &raw[0], raw.size()));
+  }
+  bool has(const std::string &chr, const std::string &strand) {
+    return chr_strand_blocks.find(chr + ";" + strand) !=
+      chr_strand_blocks.end();
+  }
+
+  bool sum(const std::string &chr, const std::string &strand,
+	   size_t start, size_t end, std::vector<double> &sums) {
+    std::map<std::string, std::vector<size_t> >::iterator it =
+      chr_strand_blocks.find(chr + ";" + strand);
+    if (it == chr_strand_blocks.end())
+      return true;  // nothing covered on this chr/strand
+    const std::vector<size_t> &bl = it->second;
+
+    // first block that may overlap start
+    size_t lo = 0, hi = bl.size();
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (blocks[bl[mid]].end <= start)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+    for(size_t b=lo; b < bl.size() && blocks[bl[b]].start < end; ++b) {
+      if (!load_block(bl[b]))
+	return false;
+      uint32_t n = blocks[bl[b]].n_records;
+      const uint32_t *run_start = (const uint32_t *) &payload[0];
+      const uint32_t *run_end = run_start + n;
+      const float *cols = (const float *) &payload[2*sizeof(uint32_t)*n];
+      // runs do not overlap, so their ends are sorted too
+      size_t r = std::upper_bound(run_end, run_end + n, (uint32_t) start) - run_end;
+      size_t r_end = std::lower_bound(run_start + r, run_start + n, (uint32_t) end) - run_start;
+      for(size_t i=r; i < r_end; ++i) {
+	double overlap = double(std::min<size_t>(run_end[i], end) -
+				std::max<size_t>(run_start[i], start));
+	for(size_t l=0; l < n_lengths; ++l)
+	  sums[l] += overlap * cols[l*n + i];
+      }
+    }
+    return true;
+  }
+};
+
+// copies the compressed blocks as they are; only the chromosome ids and
+// offsets in their index entries change
+inline bool LengthVectorBinaryWriter::append(const std::string &fn) {
+  LengthVectorBinaryReader in(fn);
+  if (!in.good() || in.num_lengths() != n_lengths)
+    return false;
+  flush_run();
+  flush_block();
+  std::vector<unsigned char> raw;
+  for(size_t i=0; i < in.num_blocks(); ++i) {
+    if (!in.read_raw_block(i, raw))
+      return false;
+    LengthVectorBlockInfo info = in.block_info(i);
+    info.chr_id = chr_id(in.chr_name(info.chr_id));
+    info.offset = out.tellp();
+    blocks.push_back(info);
+    out.write((const char *) &raw[0], raw.size());
+  }
+  return bool(out);
+}
+
+// reads the text format, using the per-chromosome index written by
+// index_genomic_lenvectors (lenvector_file.idx)
+////////////////////////////////////////////////////////////////
+// offset index of text files (.lidx, from index_genomic_lenvectors)
+//
+// Lines are sampled per chr/strand: the first line, then every line at
+// least <stride> bp past the previously sampled one.  Since lines are
+// sorted and do not overlap, the last sample at or before a position
+// is a safe place to start scanning for it.
+//
+//   header:  magic "CLVX", uint32 version, uint32 stride,
+//            uint64 size and mtime of the indexed file, uint32 n_seqs
+//   per seq: uint32 name_len, chr name, char strand, uint32 n,
+//            uint64 bp[n], uint64 offset[n]
+
+static const char LENVEC_OFFSET_INDEX_MAGIC[4] = {'C','L','V','X'};
+static const uint32_t LENVEC_OFFSET_INDEX_VERSION = 2;
+static const uint32_t LENVEC_OFFSET_INDEX_STRIDE = 100;
+
+// the size and modification time of a lenvector file, recorded in the
+// indexes built from it so that stale indexes are not used
+struct LengthVectorFileStamp {
+  uint64_t size, mtime;
+
+  LengthVectorFileStamp() : size(0), mtime(0) { }
+  LengthVectorFileStamp(const struct stat &st) :
+    size(st.st_size), mtime(st.st_mtime) { }
+
+  bool operator==(const LengthVectorFileStamp &other) const {
+    return size == other.size && mtime == other.mtime;
+  }
+};
+
+// false if the file cannot be stat'ed
+inline bool lenvec_file_stamp(const std::string &fn, LengthVectorFileStamp &stamp) {
+  struct stat st;
+  if (stat(fn.c_str(), &st) != 0)
+    return false;
+  stamp = LengthVectorFileStamp(st);
+  return true;
+}
+
+// the sampled positions of one chromosome/strand and the byte offsets
+// of their lines
+struct LengthVectorOffsets {
+  std::string chr;
+  char strand;
+  std::vector<uint64_t> bps;
+  std::vector<uint64_t> offsets;
+
+  // add the line at offset if the stride has elapsed
+  void sample(uint64_t bp, uint64_t offset, uint32_t stride) {
+    if (bps.empty() || bp >= bps.back() + stride) {
+      bps.push_back(bp);
+      offsets.push_back(offset);
+    }
+  }
+};
+
+inline bool write_lenvec_offset_index(const std::string &fn, uint32_t stride,
+				      const LengthVectorFileStamp &stamp,
+				      const std::vector<LengthVectorOffsets> &seqs) {
+  std::ofstream out(fn.c_str(), std::ios::binary);
+  if (!out.is_open())
+    return false;
+  uint32_t x;
+  out.write(LENVEC_OFFSET_INDEX_MAGIC, 4);
+  x = LENVEC_OFFSET_INDEX_VERSION;
+  out.write((const char *) &x, sizeof(x));
+  out.write((const char *) &stride, sizeof(stride));
+  out.write((const char *) &stamp.size, sizeof(stamp.size));
+  out.write((const char *) &stamp.mtime, sizeof(stamp.mtime));
+  x = seqs.size();
+  out.write((const char *) &x, sizeof(x));
+  for(size_t i=0; i < seqs.size(); ++i) {
+    const LengthVectorOffsets &seq = seqs[i];
+    x = seq.chr.size();
+    out.write((const char *) &x, sizeof(x));
+    out.write(seq.chr.data(), seq.chr.size());
+    out.write(&seq.strand, 1);
+    x = seq.bps.size();
+    out.write((const char *) &x, sizeof(x));
+    if (x > 0) {
+      out.write((const char *) &seq.bps[0], sizeof(uint64_t)*x);
+      out.write((const char *) &seq.offsets[0], sizeof(uint64_t)*x);
+    }
+  }
+  return bool(out);
+}
+
+// false if the index is missing, unreadable, corrupt or not for the
+// file with the given stamp (i.e. stale); every offset must lie within
+// the indexed file
+inline bool read_lenvec_offset_index(const std::string &fn,
+				     const LengthVectorFileStamp &stamp,
+				     std::vector<LengthVectorOffsets> &seqs) {
+  std::ifstream in(fn.c_str(), std::ios::binary);
+  char magic[4];
+  if (!in.read(magic, 4) ||
+      memcmp(magic, LENVEC_OFFSET_INDEX_MAGIC, 4) != 0)
+    return false;
+  in.seekg(0, std::ios::end);
+  uint64_t index_size = in.tellg();
+  in.seekg(4);
+  uint32_t version = 0, stride = 0, n_seqs = 0;
+  LengthVectorFileStamp indexed;
+  in.read((char *) &version, sizeof(version));
+  in.read((char *) &stride, sizeof(stride));
+  in.read((char *) &indexed.size, sizeof(indexed.size));
+  in.read((char *) &indexed.mtime, sizeof(indexed.mtime));
+  in.read((char *) &n_seqs, sizeof(n_seqs));
+  if (!in || version != LENVEC_OFFSET_INDEX_VERSION || !(indexed == stamp) ||
+      n_seqs > index_size)
+    return false;
+  seqs.resize(n_seqs);
+  for(uint32_t i=0; i < n_seqs && in; ++i) {
+    LengthVectorOffsets &seq = seqs[i];
+    uint32_t x = 0;
+    in.read((char *) &x, sizeof(x));
+    if (!in || x > index_size - uint64_t(in.tellg()))
+      return false;
+    seq.chr.resize(x);
+    if (x > 0)
+      in.read(&seq.chr[0], x);
+    in.read(&seq.strand, 1);
+    x = 0;
+    in.read((char *) &x, sizeof(x));
+    if (!in || x > (index_size - uint64_t(in.tellg())) / (2*sizeof(uint64_t)))
+      return false;
+    seq.bps.resize(x);
+    seq.offsets.resize(x);
+    if (x > 0) {
+      in.read((char *) &seq.bps[0], sizeof(uint64_t)*x);
+      in.read((char *) &seq.offsets[0], sizeof(uint64_t)*x);
+    }
+    for(uint32_t j=0; j < x; ++j)
+      if (seq.offsets[j] >= stamp.size)
+	return false;
+  }
+  return bool(in);
+}
+
+// reads text lenvector files through a read-only memory map.  Lines
+// are found through the offset index of their chromosome/strand, which
+// is loaded from the .lidx file if there is an up-to-date one, or else
+// built on first use by scanning from the chromosome's first line (as
+// given by the .idx file) and kept; so loci in any order are found by
+// binary search
+class LengthVectorTextReader : public LengthVectorReader {
+  const char *data;   // the mapped file
+  size_t data_size;
+  // byte offset of the first line of each chromosome
+  std::map<std::string, size_t> chr_idx;
+  std::map<std::string, LengthVectorOffsets> intra_chr_idx;   // by "chr;strand"
+  // index every N bp;
+  // lower = faster lookups+more mem usage
+  uint32_t intra_chr_idx_stride;
+  std::string error;
+  size_t n_lengths;
+  bool runs;   // run-collapsed file (has a header and an end column)
+  LengthVector curr_lenvec;   // reused for every line read by sum()
+
+  // the end of the line starting at offset pos (its newline, or the
+  // end of the file)
+  size_t line_end(size_t pos) const {
+    const char *eol = (const char *) memchr(data + pos, '\n', data_size - pos);
+    return eol ? eol - data : data_size;
+  }
+
+  // parse the line at offset pos; returns the offset of the next line
+  size_t parse_line(size_t pos, LengthVector &lenvec, bool load_data=true) const {
+    size_t eol = line_end(pos);
+    parse_lenvec_line(data + pos, data + eol, lenvec, runs, load_data);
+    return std::min(data_size, eol + 1);
+  }
+
+  const LengthVectorOffsets &chr_offsets(const std::string &chr, const std::string &strand) {
+    std::string chr_strand(chr + ";" + strand);
+    std::map<std::string, LengthVectorOffsets>::iterator it = intra_chr_idx.find(chr_strand);
+    if (it != intra_chr_idx.end())
+      return it->second;
+
+    LengthVectorOffsets &idx = intra_chr_idx[chr_strand];
+    LengthVector lenvec;
+    size_t pos = chr_idx[chr];
+    while (pos < data_size) {
+      size_t next = parse_line(pos, lenvec, false);
+      // stop if we hit another chr_strand
+      if (lenvec.chr != chr || lenvec.strand != strand)
+	break;
+      idx.sample(lenvec.bp, pos, intra_chr_idx_stride);
+      pos = next;
+    }
+    return idx;
+  }
+
+public:
+  LengthVectorTextReader(const std::string &fn) :
+    data(NULL), data_size(0), intra_chr_idx_stride(LENVEC_OFFSET_INDEX_STRIDE),
+    n_lengths(0),
+    runs(false) {
+    int fd = open(fn.c_str(), O_RDONLY);
+    if (fd < 0) {
+      error = "Could not open lenvector file " + fn;
+      return;
+    }
+    struct stat st;
+    LengthVectorFileStamp stamp;
+    if (fstat(fd, &st) == 0) {
+      stamp = LengthVectorFileStamp(st);
+      if (st.st_size > 0) {
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+	  error = "Could not map lenvector file " + fn;
+	else {
+	  data = (const char *) p;
+	  data_size = st.st_size;
+	}
+      }
+    }
+    close(fd);
+    if (!error.empty())
+      return;
+    if (data_size > 0)
+      runs = is_lenvec_runs_header(std::string(data, line_end(0)));
+    // a persisted offset index replaces the chromosome index
+    std::vector<LengthVectorOffsets> seqs;
+    if (read_lenvec_offset_index(fn + ".lidx", stamp, seqs)) {
+      for(size_t i=0; i < seqs.size(); ++i) {
+	if (!seqs[i].offsets.empty() && chr_idx.find(seqs[i].chr) == chr_idx.end())
+	  chr_idx[seqs[i].chr] = seqs[i].offsets.front();
+	intra_chr_idx[seqs[i].chr + ";" + seqs[i].strand] = seqs[i];
+      }
+      return;
+    }
+    // open lenvec chromosome index (lets us seek to a chromsome in O(1) time)
+    std::string idx_fn(fn + ".idx");
+    std::ifstream idx_file(idx_fn.c_str());
+    if (!idx_file.is_open()) {
+      error = "Could not find index file " + idx_fn;
+      return;
+    }
+    std::string line;
+    while(getline(idx_file, line)) {
+      std::istringstream line_str(line);
+      std::string chr, field;
+      getline(line_str, chr, '\t');
+      getline(line_str, field, '\t');
+      chr_idx[chr] = atol(field.c_str());
+    }
+  }
+
+  ~LengthVectorTextReader() {
+    if (data)
+      munmap((void *) data, data_size);
+  }
+
+  bool good() const { return error.empty(); }
+  const std::string &error_message() const { return error; }
+
+  // size of length vectors, taken from the first line
+  size_t num_lengths() {
+    if (n_lengths == 0) {
+      size_t pos = 0;
+      while (pos < data_size) {
+	if (data[pos] != '#' && data[pos] != '\n') {
+	  LengthVector lenvec;
+	  parse_line(pos, lenvec);
+	  n_lengths = lenvec.data.size();
+	  break;
+	}
+	pos = std::min(data_size, line_end(pos) + 1);
+      }
+    }
+    return n_lengths;
+  }
+
+  bool has(const std::string &chr, const std::string &strand) {
+    return chr_idx.find(chr) != chr_idx.end() &&
+      !chr_offsets(chr, strand).bps.empty();
+  }
+
+  bool sum(const std::string &chr, const std::string &strand,
+	   size_t start, size_t end, std::vector<double> &sums) {
+    if (chr_idx.find(chr) == chr_idx.end())
+      return true;  // nothing covered on this chr
+    const LengthVectorOffsets &idx = chr_offsets(chr, strand);
+
+    // find the first position occurring before our query pos
+    std::vector<uint64_t>::const_iterator it =
+      std::upper_bound(idx.bps.begin(), idx.bps.end(), start);
+    if (it != idx.bps.begin())
+      --it;
+    if (it == idx.bps.end())
+      return true;
+    size_t pos = idx.offsets[it - idx.bps.begin()];
+    LengthVector &lenvec = curr_lenvec;
+    while (pos < data_size) {
+      pos = parse_line(pos, lenvec);
+      // stop when we pass the chr_strand or the locus' end
+      if (lenvec.chr != chr || lenvec.strand != strand ||
+	  lenvec.bp >= end)
+	break;
+      // skip positions before the locus start
+      if (lenvec.end <= start)
+	continue;
+      // accumulate sum, weighting runs by their overlap with the locus
+      double overlap = double(std::min(lenvec.end, end) -
+			      std::max(lenvec.bp, start));
+      for(size_t i=0; i < sums.size() && i < lenvec.data.size(); ++i)
+	sums[i] += overlap * lenvec.data[i];
+    } // for each lenvec line
+    return true;
+  }
+};
+
+////////////////////////////////////////////////////////////////
+// prefix-sum cube (.cube, from index_genomic_lenvectors -c)
+//
+// For each chr/strand, one row per run holds the run's [start,end) and,
+// per read length, the sum of count*bp over all preceding runs; a final
+// row holds the totals.  The sum over any interval is then the
+// difference of two prefix sums, found by binary search, regardless of
+// the interval's length.
+//
+//   header:  magic "CLVC", uint32 version, uint32 n_lengths, uint32 0,
+//            uint64 size and mtime of the source file  (keeps the rows
+//            8-aligned)
+//   per seq: rows of {uint32 start, uint32 end, double cum[n_lengths]}
+//   index:   uint32 n_seqs, then per seq: uint32 name_len, chr name,
+//            char strand, uint64 offset, uint32 n_rows
+//   footer:  uint64 index offset, magic "CLVD"
+
+static const char LENVEC_CUBE_MAGIC[4] = {'C','L','V','C'};
+static const char LENVEC_CUBE_INDEX_MAGIC[4] = {'C','L','V','D'};
+static const uint32_t LENVEC_CUBE_VERSION = 2;
+
+struct LengthVectorCubeSeq {
+  std::string chr;
+  char strand;
+  uint64_t offset;
+  uint32_t n_rows;
+};
+
+class LengthVectorCubeWriter {
+  std::ofstream out;
+  uint32_t n_lengths;
+  std::vector<LengthVectorCubeSeq> seqs;
+  std::vector<double> cum;
+  uint32_t prev_end;
+
+  void put_row(uint32_t start, uint32_t end) {
+    out.write((const char *) &start, sizeof(start));
+    out.write((const char *) &end, sizeof(end));
+    out.write((const char *) &cum[0], sizeof(double)*n_lengths);
+    ++seqs.back().n_rows;
+  }
+
+  void finish_seq() {
+    if (!seqs.empty())
+      put_row(prev_end, prev_end);
+  }
+
+public:
+  LengthVectorCubeWriter(const std::string &fn, uint32_t nlen,
+			 const LengthVectorFileStamp &source) :
+    out(fn.c_str(), std::ios::binary), n_lengths(nlen), cum(nlen, 0.0),
+    prev_end(0) {
+    uint32_t x;
+    out.write(LENVEC_CUBE_MAGIC, 4);
+    x = LENVEC_CUBE_VERSION;
+    out.write((const char *) &x, sizeof(x));
+    out.write((const char *) &n_lengths, sizeof(n_lengths));
+    x = 0;
+    out.write((const char *) &x, sizeof(x));
+    out.write((const char *) &source.size, sizeof(source.size));
+    out.write((const char *) &source.mtime, sizeof(source.mtime));
+  }
+
+  bool is_open() const { return out.is_open(); }
+
+  // add the next run; runs come sorted within a chromosome/strand
+  void add(const LengthVector &lenvec) {
+    if (seqs.empty() || seqs.back().chr != lenvec.chr ||
+	seqs.back().strand != lenvec.strand[0]) {
+      finish_seq();
+      LengthVectorCubeSeq seq;
+      seq.chr = lenvec.chr;
+      seq.strand = lenvec.strand[0];
+      seq.offset = out.tellp();
+      seq.n_rows = 0;
+      seqs.push_back(seq);
+      std::fill(cum.begin(), cum.end(), 0.0);
+    }
+    put_row(lenvec.bp, lenvec.end);
+    for(size_t i=0; i < n_lengths && i < lenvec.data.size(); ++i)
+      cum[i] += double(lenvec.end - lenvec.bp) * lenvec.data[i];
+    prev_end = lenvec.end;
+  }
+
+  bool close() {
+    finish_seq();
+    uint64_t index_offset = out.tellp();
+    uint32_t x = seqs.size();
+    out.write((const char *) &x, sizeof(x));
+    for(size_t i=0; i < seqs.size(); ++i) {
+      x = seqs[i].chr.size();
+      out.write((const char *) &x, sizeof(x));
+      out.write(seqs[i].chr.data(), seqs[i].chr.size());
+      out.write(&seqs[i].strand, 1);
+      out.write((const char *) &seqs[i].offset, sizeof(seqs[i].offset));
+      out.write((const char *) &seqs[i].n_rows, sizeof(seqs[i].n_rows));
+    }
+    out.write((const char *) &index_offset, sizeof(index_offset));
+    out.write(LENVEC_CUBE_INDEX_MAGIC, 4);
+    out.close();
+    return !out.fail();
+  }
+};
+
+class LengthVectorCubeReader : public LengthVectorReader {
+  const char *data;   // the mapped file
+  size_t data_size;
+  uint32_t n_lengths;
+  size_t row_size;
+  std::map<std::string, LengthVectorCubeSeq> seqs;   // by "chr;strand"
+  std::string error;
+
+  uint32_t row_start(const char *row) const { return *(const uint32_t *) row; }
+  uint32_t row_end(const char *row) const { return *(const uint32_t *) (row + 4); }
+  const double *row_cum(const char *row) const { return (const double *) (row + 8); }
+
+  // add sign * (sum of count*bp before pos) to sums
+  void add_prefix(const LengthVectorCubeSeq &seq, size_t pos, double sign,
+		  std::vector<double> &sums) const {
+    if (seq.n_rows < 2)
+      return;
+    const char *rows = data + seq.offset;
+    // last run starting at or before pos; the final row is not a run
+    size_t lo = 0, hi = seq.n_rows - 1;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (row_start(rows + mid*row_size) <= pos)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+    if (lo == 0)
+      return;
+    const char *row = rows + (lo-1)*row_size;
+    const double *before = row_cum(row), *after = row_cum(row + row_size);
+    size_t start = row_start(row), end = row_end(row);
+    for(size_t i=0; i < sums.size() && i < n_lengths; ++i) {
+      double prefix = after[i];
+      if (pos < end)   // within the run
+	prefix = before[i] + (after[i] - before[i]) *
+	  double(pos - start) / double(end - start);
+      sums[i] += sign * prefix;
+    }
+  }
+
+public:
+  LengthVectorCubeReader(const std::string &fn,
+			 const LengthVectorFileStamp &source) :
+    data(NULL), data_size(0), n_lengths(0), row_size(0) {
+    int fd = open(fn.c_str(), O_RDONLY);
+    if (fd < 0) {
+      error = "Could not open lenvector cube " + fn;
+      return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+	data = (const char *) p;
+	data_size = st.st_size;
+      }
+    }
+    close(fd);
+    const size_t header_size = 4 + 3*sizeof(uint32_t) + 2*sizeof(uint64_t);
+    const size_t footer_size = sizeof(uint64_t) + 4;
+    if (data_size < header_size + footer_size ||
+	memcmp(data, LENVEC_CUBE_MAGIC, 4) != 0 ||
+	memcmp(data + data_size - 4, LENVEC_CUBE_INDEX_MAGIC, 4) != 0) {
+      error = "not a lenvector cube (or truncated): " + fn;
+      return;
+    }
+    uint32_t version;
+    LengthVectorFileStamp indexed;
+    memcpy(&version, data + 4, sizeof(version));
+    memcpy(&n_lengths, data + 8, sizeof(n_lengths));
+    memcpy(&indexed.size, data + 16, sizeof(indexed.size));
+    memcpy(&indexed.mtime, data + 24, sizeof(indexed.mtime));
+    if (version != LENVEC_CUBE_VERSION) {
+      error = "unsupported lenvector cube version: " + fn;
+      return;
+    }
+    if (!(indexed == source)) {
+      error = "lenvector cube is out of date: " + fn;
+      return;
+    }
+    if (n_lengths > data_size / sizeof(double)) {
+      error = "corrupt lenvector cube: " + fn;
+      return;
+    }
+    row_size = 2*sizeof(uint32_t) + sizeof(double)*n_lengths;
+
+    // the index lies between the rows and the footer, and every
+    // sequence's rows between the header and the index
+    uint64_t index_offset;
+    memcpy(&index_offset, data + data_size - footer_size, sizeof(index_offset));
+    const char *index_end = data + data_size - footer_size;
+    if (index_offset < header_size || index_offset > data_size - footer_size) {
+      error = "corrupt lenvector cube index: " + fn;
+      return;
+    }
+    const char *p = data + index_offset;
+    uint32_t n_seqs, x;
+    if (index_end - p < (ptrdiff_t) sizeof(n_seqs)) {
+      error = "corrupt lenvector cube index: " + fn;
+      return;
+    }
+    memcpy(&n_seqs, p, sizeof(n_seqs));
+    p += sizeof(n_seqs);
+    const size_t seq_entry_size = sizeof(x) + 1 + sizeof(uint64_t) + sizeof(uint32_t);
+    for(uint32_t i=0; i < n_seqs; ++i) {
+      LengthVectorCubeSeq seq;
+      if (index_end - p < (ptrdiff_t) seq_entry_size) {
+	error = "corrupt lenvector cube index: " + fn;
+	return;
+      }
+      memcpy(&x, p, sizeof(x));
+      p += sizeof(x);
+      if (uint64_t(index_end - p) < uint64_t(x) + seq_entry_size - sizeof(x)) {
+	error = "corrupt lenvector cube index: " + fn;
+	return;
+      }
+      seq.chr.assign(p, x);
+      p += x;
+      seq.strand = *p++;
+      memcpy(&seq.offset, p, sizeof(seq.offset));
+      p += sizeof(seq.offset);
+      memcpy(&seq.n_rows, p, sizeof(seq.n_rows));
+      p += sizeof(seq.n_rows);
+      if (seq.offset < header_size || seq.offset > index_offset ||
+	  seq.n_rows > (index_offset - seq.offset) / row_size) {
+	error = "corrupt lenvector cube index: " + fn;
+	return;
+      }
+      seqs[seq.chr + ";" + seq.strand] = seq;
+    }
+  }
+
+  ~LengthVectorCubeReader() {
+    if (data)
+      munmap((void *) data, data_size);
+  }
+
+  bool good() const { return error.empty(); }
+  const std::string &error_message() const { return error; }
+  size_t num_lengths() { return n_lengths; }
+
+  bool has(const std::string &chr, const std::string &strand) {
+    return seqs.find(chr + ";" + strand) != seqs.end();
+  }
+
+  bool sum(const std::string &chr, const std::string &strand,
+	   size_t start, size_t end, std::vector<double> &sums) {
+    std::map<std::string, LengthVectorCubeSeq>::const_iterator it =
+      seqs.find(chr + ";" + strand);
+    if (it == seqs.end())
+      return true;  // nothing covered on this chr/strand
+    add_prefix(it->second, end, 1.0, sums);
+    add_prefix(it->second, start, -1.0, sums);
+    return true;
+  }
+};
+
+// size of a file, or 0 if it cannot be read
+inline uint64_t lenvec_file_size(const std::string &fn) {
+  struct stat st;
+  if (stat(fn.c_str(), &st) != 0)
+    return 0;
+  return st.st_size;
+}
+
+// open a lenvector file of either format, or its prefix-sum cube if
+// there is an up-to-date one
+inline LengthVectorReader *open_lenvec_reader(const std::string &fn) {
+  std::string cube_fn(fn + ".cube");
+  if (lenvec_file_size(cube_fn) > 0) {
+    LengthVectorFileStamp source;
+    lenvec_file_stamp(fn, source);
+    LengthVectorCubeReader *cube = new LengthVectorCubeReader(cube_fn, source);
+    if (cube->good())
+      return cube;
+    std::cerr << cube->error_message() << "; not using it\n";
+    delete cube;
+  }
+  if (is_binary_lenvec_file(fn))
+    return new LengthVectorBinaryReader(fn);
+  return new LengthVectorTextReader(fn);
+}
+
+#endif
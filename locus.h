@@ -0,0 +1,332 @@
+//  Copyright (c) 2013 University of Pennsylvania
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+
+// loci (BED entries) and the per-locus features computed from the reads
+// that overlap them
+
+#ifndef CORAL_LOCUS_H
+#define CORAL_LOCUS_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include "bam.h"
+#include "tokenizer.h"
+
+struct BEDEntry {
+  std::string chr;
+  size_t start, end;
+  std::string name;
+  int score;
+  std::string strand;
+};
+
+inline void parse_bed_line(const std::string &line, BEDEntry &result) {
+  FieldTokenizer fields(line);
+  const char *b = line.data(), *e = b;
+  fields.next(result.chr);
+  fields.next(b, e);
+  result.start = parse_long(b, e);
+  fields.next(b, e);
+  result.end = parse_long(b, e);
+  fields.next(result.name);
+  fields.next(b, e);
+  // NOTE: assumes score is integer
+  result.score = parse_long(b, e);
+  fields.next(result.strand);
+}
+
+////////////////////////////////////////////////////////////////
+// reads
+
+// reads are weighted by 1/(number of mapping locations)
+inline float read_weight(const bam1_t *b) {
+  //uint8_t *aux_data = bam_aux_get(b, "XW");
+  //float read_weight = bam_aux2f( aux_data );
+  return 1.0/float( bam_aux2i(bam_aux_get(b, "NH")));
+}
+
+// true if the read lies on the locus' strand
+inline bool is_sense(const bam1_t *b, const BEDEntry &locus) {
+  return bam1_strand(b) == (locus.strand == "-");
+}
+
+// an indexed BAM file, opened for the reads of loci
+class LocusBam {
+  std::map<std::string, int> chr_tids;
+
+  LocusBam(const LocusBam &);
+  LocusBam &operator=(const LocusBam &);
+
+public:
+  bamFile fp;
+  bam_header_t *hdr;
+  bam_index_t *idx;
+
+  LocusBam() : fp(0), hdr(0), idx(0) { }
+  ~LocusBam() { close(); }
+
+  // false, with the reason on cerr, if the file or its index cannot
+  // be loaded. cache_size bytes of inflated blocks are kept, so that
+  // loci fetched one after the other inflate the blocks they share once
+  bool open(const char *bam_fn, int cache_size=0) {
+    if ((fp = bam_open(bam_fn, "r")) == 0) {
+      std::cerr << "Failed to open BAM file " << bam_fn << "\n";
+      return false;
+    }
+    bgzf_set_cache_size(fp, cache_size);
+    if ((hdr = bam_header_read(fp)) == 0) {
+      std::cerr << "Failed to read the header of " << bam_fn << "\n";
+      close();
+      return false;
+    }
+    for(int i=0; i < hdr->n_targets; ++i)
+      chr_tids[hdr->target_name[i]] = i;
+    idx = bam_index_load(bam_fn);
+    if (idx == 0) {
+      std::cerr << "Failed to load the index of " << bam_fn
+		<< " (run samtools index first)\n";
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (idx)
+      bam_index_destroy(idx);
+    if (hdr)
+      bam_header_destroy(hdr);
+    if (fp)
+      bam_close(fp);
+    idx = 0;
+    hdr = 0;
+    fp = 0;
+    chr_tids.clear();
+  }
+
+  // the reference id of chr, -1 if it is not in the BAM header
+  int tid(const std::string &chr) const {
+    std::map<std::string, int>::const_iterator it = chr_tids.find(chr);
+    return it == chr_tids.end() ? -1 : it->second;
+  }
+
+  // call func on the reads overlapping the locus; none if its
+  // chromosome is not in the BAM file
+  void fetch(const BEDEntry &locus, void *data, bam_fetch_f func) {
+    int t = tid(locus.chr);
+    if (t >= 0)
+      bam_fetch(fp, idx, t, locus.start, locus.end, data, func);
+  }
+};
+
+////////////////////////////////////////////////////////////////
+// length feature
+
+// add a read's weight to the length sums once for every bp it shares
+// with the locus; the same as summing the genomic length vectors over
+// the locus
+inline void add_read_length(std::vector<double> &lenvec_sum, int min_read_len,
+			    const BEDEntry &locus, size_t read_start,
+			    int read_len, float weight) {
+  int l = read_len - min_read_len;
+  if (l < 0 || l >= int(lenvec_sum.size()))
+    return;
+  size_t read_end = read_start + read_len;
+  size_t s = std::max(read_start, locus.start);
+  size_t e = std::min(read_end, locus.end);
+  if (e > s)
+    lenvec_sum[l] += double(weight) * double(e - s);
+}
+
+inline void write_lenvec_header(std::ostream &os, int min_read_len,
+				size_t n_lengths) {
+  os << "name";
+  for(size_t i=0; i < n_lengths; ++i)
+    os << "\tE" << (min_read_len+i);
+  os << "\n";
+}
+
+// write the per-bp normalized, smoothed log2 odds of the length sums
+inline void write_lenvec_feature(std::ostream &os, const BEDEntry &locus,
+				 std::vector<double> &lenvec_sum) {
+  size_t n_lengths = lenvec_sum.size();
+
+  // normalize sum by locus length
+  double row_sum(0);
+  for(size_t i=0; i < n_lengths; ++i) {
+    lenvec_sum[i] /= double(locus.end-locus.start); // count per bp
+    ++lenvec_sum[i];   // laplace smoothing
+    row_sum += lenvec_sum[i];
+  }
+
+  double expected_prob = 1.0/double(lenvec_sum.size());
+
+  // print output
+
+  os << locus.name;
+
+  for(size_t i=0; i < n_lengths; ++i) {
+    // convert to probability
+    lenvec_sum[i] /= row_sum;
+    // convert to log2 odds ratio versus expected probability
+    lenvec_sum[i] = log2(lenvec_sum[i] / expected_prob);
+    os << "\t" << lenvec_sum[i];
+  }
+  os << "\n";
+}
+
+////////////////////////////////////////////////////////////////
+// nucleotide feature
+
+// add the A/C/G/T bases of a read to counts[4]; other codes (N, and the
+// ambiguity codes with more than one bit set) are skipped.
+// BAM packs one base per nibble with A=1, C=2, G=4, T=8, so 16 bases
+// are counted at once: the i-th bit of every nibble is shifted down to
+// bit 0, a base is counted where exactly that bit is set, and the
+// matching nibbles are popcounted
+inline uint64_t nibble_base_bits(uint64_t x, int bit) {
+  return (x >> bit) & 0x1111111111111111ULL;
+}
+
+inline void count_packed_bases(uint64_t x, uint64_t counts[4]) {
+  uint64_t b0 = nibble_base_bits(x, 0), b1 = nibble_base_bits(x, 1);
+  uint64_t b2 = nibble_base_bits(x, 2), b3 = nibble_base_bits(x, 3);
+  counts[0] += __builtin_popcountll(b0 & ~(b1 | b2 | b3));  // A
+  counts[1] += __builtin_popcountll(b1 & ~(b0 | b2 | b3));  // C
+  counts[2] += __builtin_popcountll(b2 & ~(b0 | b1 | b3));  // G
+  counts[3] += __builtin_popcountll(b3 & ~(b0 | b1 | b2));  // T
+}
+
+inline void count_bases(const bam1_t *b, double counts[4]) {
+  const uint8_t *seq = bam1_seq(b);
+  int n_bytes = (b->core.l_qseq + 1) / 2;
+  uint64_t base_counts[4] = {0, 0, 0, 0};
+  uint64_t x;
+  int i = 0;
+  // the last byte always goes through the tail below
+  for(; i + 8 < n_bytes; i += 8) {
+    memcpy(&x, seq + i, 8);
+    count_packed_bases(x, base_counts);
+  }
+  // zero-padded tail of 1-8 bytes; code 0 is not a base
+  uint8_t tail[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  memcpy(tail, seq + i, n_bytes - i);
+  if (b->core.l_qseq % 2)
+    tail[n_bytes - i - 1] &= 0xf0;  // unused low nibble of the last byte
+  memcpy(&x, tail, 8);
+  count_packed_bases(x, base_counts);
+  for(int j=0; j < 4; ++j)
+    counts[j] += base_counts[j];
+}
+
+// additively smoothed (+1) log odds versus equal nucleotide frequencies
+inline void write_nuc_feature(std::ostream &os, const BEDEntry &locus,
+			      const double counts[4]) {
+  double smoothed[4];
+  for(int i=0; i < 4; ++i)
+    smoothed[i] = counts[i] + 1;
+  // as in the original feature_nuc.sh, the total is smoothed once more
+  double s = 4 + smoothed[0] + smoothed[1] + smoothed[2] + smoothed[3];
+  os << locus.name;
+  for(int i=0; i < 4; ++i)
+    os << "\t" << log( (smoothed[i]/s) / 0.25 );
+  os << "\n";
+}
+
+////////////////////////////////////////////////////////////////
+// position entropy feature
+
+// counts of read end positions near a locus; the count array is an
+// arena reused from locus to locus, and only the bins that were touched
+// are cleared again
+class PositionHistogram {
+public:
+  PositionHistogram() : base(0), n(0) { }
+
+  // start an empty histogram, with the arena centered on first_pos
+  void reset(int first_pos) {
+    for(size_t i=0; i < touched.size(); ++i)
+      counts[touched[i]] = 0;
+    touched.clear();
+    n = 0;
+    base = first_pos - int(counts.size()/2);
+  }
+
+  void add(int pos) {
+    if (pos < base || pos - base >= int(counts.size()))
+      grow(pos);
+    int &count = counts[pos - base];
+    if (count++ == 0)
+      touched.push_back(pos - base);
+    ++n;
+  }
+
+  // Shannon entropy (in nats) of the positions
+  double entropy() const {
+    double entropy = 0;
+    for(size_t i=0; i < touched.size(); ++i) {
+      double prob = double(counts[touched[i]]) / double(n);
+      entropy -= prob * log(prob);
+    }
+    return entropy + 0.0;  // no "-0"
+  }
+
+private:
+  // make room for pos, keeping slack on both sides
+  void grow(int pos) {
+    int slack = std::max(1024, int(counts.size()));
+    int new_base = std::min(base, pos) - slack;
+    int new_end = std::max(base + int(counts.size()), pos + 1) + slack;
+    std::vector<int> new_counts(new_end - new_base, 0);
+    for(size_t i=0; i < touched.size(); ++i) {
+      new_counts[touched[i] + base - new_base] = counts[touched[i]];
+      touched[i] += base - new_base;
+    }
+    counts.swap(new_counts);
+    base = new_base;
+  }
+
+  std::vector<int> counts;
+  std::vector<int> touched;  // bins with a nonzero count
+  int base;                  // position of counts[0]
+  int n;
+};
+
+// 5' and 3' ends of a read, relative to its strand
+inline void read_ends(const bam1_t *b, int &five_p, int &three_p) {
+  int start = b->core.pos;
+  int end = b->core.pos + b->core.l_qseq;
+  if (bam1_strand(b)) {
+    five_p = end;
+    three_p = start;
+  } else {
+    five_p = start;
+    three_p = end;
+  }
+}
+
+#endif
@@ -198,6 +198,7 @@ typedef struct {
 } bam1_t;
 
 typedef struct __bam_iter_t *bam_iter_t;
+typedef struct __bam_miter_t *bam_miter_t;
 
 #define bam1_strand(b) (((b)->core.flag&BAM_FREVERSE) != 0)
 #define bam1_mstrand(b) (((b)->core.flag&BAM_FMREVERSE) != 0)
@@ -629,6 +630,30 @@ extern "C" {
 	int bam_iter_read(bamFile fp, bam_iter_t iter, bam1_t *b);
 	void bam_iter_destroy(bam_iter_t iter);
 
+	/*!
+	  @abstract  Retrieve the alignments overlapping any of a set of regions
+	  @discussion Every alignment is read once, in file order, together
+	  with the indices of the regions it overlaps, in order of their start.
+	  Regions on a negative tid or with end <= beg are skipped; the
+	  regions need not be sorted.
+
+	  @param  idx   pointer to the alignment index
+	  @param  n     number of regions
+	  @param  tid   chromosome IDs of the regions
+	  @param  beg   start coordinates, 0-based
+	  @param  end   end coordinates, 0-based, exclusive
+	 */
+	bam_miter_t bam_miter_query(const bam_index_t *idx, int n, const int *tid, const int *beg, const int *end);
+
+	/*!
+	  @abstract  Read the next alignment overlapping a region of iter
+	  @param  hits    the indices of the overlapped regions (owned by iter)
+	  @param  n_hits  the number of overlapped regions
+	  @return         as bam_read1(); -1 after the last alignment
+	 */
+	int bam_miter_read(bamFile fp, bam_miter_t iter, bam1_t *b, const int **hits, int *n_hits);
+	void bam_miter_destroy(bam_miter_t iter);
+
 	/*!
 	  @abstract       Parse a region in the format: "chr2:100,000-200,000".
 	  @discussion     bam_header_t::hash will be initialized if empty.
@@ -575,6 +575,54 @@ struct __bam_iter_t {
 	pair64_t *off;
 };
 
+// the linear index bound: alignments overlapping beg start after it
+static uint64_t min_offset(const bam_index_t *idx, int tid, int beg)
+{
+	int i;
+	uint64_t min_off;
+	if (idx->index2[tid].n > 0) {
+		min_off = (beg>>BAM_LIDX_SHIFT >= idx->index2[tid].n)? idx->index2[tid].offset[idx->index2[tid].n-1]
+			: idx->index2[tid].offset[beg>>BAM_LIDX_SHIFT];
+		if (min_off == 0) { // improvement for index files built by tabix prior to 0.1.4
+			int n = beg>>BAM_LIDX_SHIFT;
+			if (n > idx->index2[tid].n) n = idx->index2[tid].n;
+			for (i = n - 1; i >= 0; --i)
+				if (idx->index2[tid].offset[i] != 0) break;
+			if (i >= 0) min_off = idx->index2[tid].offset[i];
+		}
+	} else min_off = 0; // tabix 0.1.2 may produce such index files
+	return min_off;
+}
+
+// sort the chunks and merge those that overlap or are adjacent; returns the new number of chunks
+static int resolve_chunks(pair64_t *off, int n_off)
+{
+	int i, l;
+	ks_introsort(off, n_off, off);
+	// resolve completely contained adjacent blocks
+	for (i = 1, l = 0; i < n_off; ++i)
+		if (off[l].v < off[i].v)
+			off[++l] = off[i];
+	n_off = l + 1;
+	// resolve overlaps between adjacent blocks; this may happen due to the merge in indexing
+	for (i = 1; i < n_off; ++i)
+		if (off[i-1].v >= off[i].u) off[i-1].v = off[i].u;
+	{ // merge adjacent blocks
+#if defined(BAM_TRUE_OFFSET) || defined(BAM_VIRTUAL_OFFSET16)
+		for (i = 1, l = 0; i < n_off; ++i) {
+#ifdef BAM_TRUE_OFFSET
+			if (off[l].v + BAM_MIN_CHUNK_GAP > off[i].u) off[l].v = off[i].v;
+#else
+			if (off[l].v>>16 == off[i].u>>16) off[l].v = off[i].v;
+#endif
+			else off[++l] = off[i];
+		}
+		n_off = l + 1;
+#endif
+	}
+	return n_off;
+}
+
 // bam_fetch helper function retrieves 
 bam_iter_t bam_iter_query(const bam_index_t *idx, int tid, int beg, int end)
 {
@@ -595,17 +643,7 @@ bam_iter_t bam_iter_query(const bam_index_t *idx, int tid, int beg, int end)
 	bins = (uint16_t*)calloc(BAM_MAX_BIN, 2);
 	n_bins = reg2bins(beg, end, bins);
 	index = idx->index[tid];
-	if (idx->index2[tid].n > 0) {
-		min_off = (beg>>BAM_LIDX_SHIFT >= idx->index2[tid].n)? idx->index2[tid].offset[idx->index2[tid].n-1]
-			: idx->index2[tid].offset[beg>>BAM_LIDX_SHIFT];
-		if (min_off == 0) { // improvement for index files built by tabix prior to 0.1.4
-			int n = beg>>BAM_LIDX_SHIFT;
-			if (n > idx->index2[tid].n) n = idx->index2[tid].n;
-			for (i = n - 1; i >= 0; --i)
-				if (idx->index2[tid].offset[i] != 0) break;
-			if (i >= 0) min_off = idx->index2[tid].offset[i];
-		}
-	} else min_off = 0; // tabix 0.1.2 may produce such index files
+	min_off = min_offset(idx, tid, beg);
 	for (i = n_off = 0; i < n_bins; ++i) {
 		if ((k = kh_get(i, index, bins[i])) != kh_end(index))
 			n_off += kh_value(index, k).n;
@@ -626,33 +664,7 @@ bam_iter_t bam_iter_query(const bam_index_t *idx, int tid, int beg, int end)
 	if (n_off == 0) {
 		free(off); return iter;
 	}
-	{
-		bam1_t *b = (bam1_t*)calloc(1, sizeof(bam1_t));
-		int l;
-		ks_introsort(off, n_off, off);
-		// resolve completely contained adjacent blocks
-		for (i = 1, l = 0; i < n_off; ++i)
-			if (off[l].v < off[i].v)
-				off[++l] = off[i];
-		n_off = l + 1;
-		// resolve overlaps between adjacent blocks; this may happen due to the merge in indexing
-		for (i = 1; i < n_off; ++i)
-			if (off[i-1].v >= off[i].u) off[i-1].v = off[i].u;
-		{ // merge adjacent blocks
-#if defined(BAM_TRUE_OFFSET) || defined(BAM_VIRTUAL_OFFSET16)
-			for (i = 1, l = 0; i < n_off; ++i) {
-#ifdef BAM_TRUE_OFFSET
-				if (off[l].v + BAM_MIN_CHUNK_GAP > off[i].u) off[l].v = off[i].v;
-#else
-				if (off[l].v>>16 == off[i].u>>16) off[l].v = off[i].v;
-#endif
-				else off[++l] = off[i];
-			}
-			n_off = l + 1;
-#endif
-		}
-		bam_destroy1(b);
-	}
+	n_off = resolve_chunks(off, n_off);
 	iter->n_off = n_off; iter->off = off;
 	return iter;
 }
@@ -672,6 +684,27 @@ void bam_iter_destroy(bam_iter_t iter)
 	if (iter) { free(iter->off); free(iter); }
 }
 
+// read the next alignment of the chunks of iter; -1 after the last chunk
+static int read_chunks(bamFile fp, bam_iter_t iter, bam1_t *b)
+{
+	int ret;
+	if (iter->curr_off == 0 || iter->curr_off >= iter->off[iter->i].v) { // then jump to the next chunk
+		if (iter->i == iter->n_off - 1) return -1; // no more chunks
+		if (iter->i >= 0) assert(iter->curr_off == iter->off[iter->i].v); // otherwise bug
+		if (iter->i < 0 || iter->off[iter->i].v != iter->off[iter->i+1].u) { // not adjacent chunks; then seek
+			bam_seek(fp, iter->off[iter->i+1].u, SEEK_SET);
+			iter->curr_off = bam_tell(fp);
+		}
+		++iter->i;
+		// have the OS read the next chunk while this one is parsed
+		if (iter->i + 1 < iter->n_off && iter->off[iter->i].v != iter->off[iter->i+1].u)
+			bgzf_prefetch(fp, iter->off[iter->i+1].u, iter->off[iter->i+1].v);
+	}
+	if ((ret = bam_read1(fp, b)) >= 0)
+		iter->curr_off = bam_tell(fp);
+	return ret;
+}
+
 int bam_iter_read(bamFile fp, bam_iter_t iter, bam1_t *b)
 {
 	int ret;
@@ -682,29 +715,148 @@ int bam_iter_read(bamFile fp, bam_iter_t iter, bam1_t *b)
 		return ret;
 	}
 	if (iter->off == 0) return -1;
-	for (;;) {
-		if (iter->curr_off == 0 || iter->curr_off >= iter->off[iter->i].v) { // then jump to the next chunk
-			if (iter->i == iter->n_off - 1) { ret = -1; break; } // no more chunks
-			if (iter->i >= 0) assert(iter->curr_off == iter->off[iter->i].v); // otherwise bug
-			if (iter->i < 0 || iter->off[iter->i].v != iter->off[iter->i+1].u) { // not adjacent chunks; then seek
-				bam_seek(fp, iter->off[iter->i+1].u, SEEK_SET);
-				iter->curr_off = bam_tell(fp);
+	while ((ret = read_chunks(fp, iter, b)) >= 0) {
+		if (b->core.tid != iter->tid || b->core.pos >= iter->end) { // no need to proceed
+			ret = bam_validate1(NULL, b)? -1 : -5; // determine whether end of region or error
+			break;
+		}
+		else if (is_overlap(iter->beg, iter->end, b)) return ret;
+	}
+	iter->finished = 1;
+	return ret;
+}
+
+/*
+  Multi-region queries: the chunks of all regions are collected with
+  each bin looked up once per chromosome, then sorted and merged, so
+  every alignment is read at most once however many regions it
+  overlaps. The regions are kept sorted by position; those that may
+  overlap the coming alignments are "active".
+ */
+
+typedef struct {
+	int tid, beg, end, i;
+} region_t;
+
+#define region_lt(a,b) ((a).tid < (b).tid || ((a).tid == (b).tid && ((a).beg < (b).beg || ((a).beg == (b).beg && (a).i < (b).i))))
+KSORT_INIT(reg, region_t, region_lt)
+
+struct __bam_miter_t {
+	int n_reg, next; // next region to activate
+	region_t *reg;
+	int n_act, *act; // indices into reg, in position order
+	int n_hits, *hits;
+	struct __bam_iter_t iter; // the chunks of all regions
+};
+
+bam_miter_t bam_miter_query(const bam_index_t *idx, int n, const int *tid, const int *beg, const int *end)
+{
+	uint16_t *bins, *used;
+	uint64_t *bin_off; // smallest linear index bound of the regions in a bin
+	int i, j, l, n_bins, n_used, n_off, m_off;
+	pair64_t *off;
+	khint_t k;
+	bam_miter_t iter;
+
+	iter = calloc(1, sizeof(struct __bam_miter_t));
+	iter->reg = malloc((n > 0? n : 1) * sizeof(region_t));
+	for (i = l = 0; i < n; ++i) { // skip empty regions and unknown references
+		int b = beg[i] < 0? 0 : beg[i];
+		if (tid[i] < 0 || tid[i] >= idx->n || end[i] <= b) continue;
+		iter->reg[l].tid = tid[i], iter->reg[l].beg = b, iter->reg[l].end = end[i];
+		iter->reg[l++].i = i;
+	}
+	iter->n_reg = l;
+	ks_introsort(reg, iter->n_reg, iter->reg);
+	iter->act = malloc((l > 0? l : 1) * sizeof(int));
+	iter->hits = malloc((l > 0? l : 1) * sizeof(int));
+	iter->iter.i = -1;
+
+	bins = (uint16_t*)calloc(BAM_MAX_BIN, 2);
+	used = (uint16_t*)calloc(BAM_MAX_BIN, 2);
+	bin_off = (uint64_t*)malloc(BAM_MAX_BIN * 8);
+	for (i = 0; i < BAM_MAX_BIN; ++i) bin_off[i] = (uint64_t)-1;
+	off = 0; n_off = m_off = 0;
+	for (i = 0; i < iter->n_reg; i = j) { // one reference at a time
+		int t = iter->reg[i].tid;
+		khash_t(i) *index = idx->index[t];
+		n_used = 0;
+		for (j = i; j < iter->n_reg && iter->reg[j].tid == t; ++j) {
+			uint64_t min_off = min_offset(idx, t, iter->reg[j].beg);
+			n_bins = reg2bins(iter->reg[j].beg, iter->reg[j].end, bins);
+			for (l = 0; l < n_bins; ++l) {
+				if (bin_off[bins[l]] == (uint64_t)-1) used[n_used++] = bins[l];
+				if (min_off < bin_off[bins[l]]) bin_off[bins[l]] = min_off;
 			}
-			++iter->i;
 		}
-		if ((ret = bam_read1(fp, b)) >= 0) {
-			iter->curr_off = bam_tell(fp);
-			if (b->core.tid != iter->tid || b->core.pos >= iter->end) { // no need to proceed
-				ret = bam_validate1(NULL, b)? -1 : -5; // determine whether end of region or error
-				break;
+		for (l = 0; l < n_used; ++l) {
+			if ((k = kh_get(i, index, used[l])) != kh_end(index)) {
+				int x;
+				bam_binlist_t *p = &kh_value(index, k);
+				for (x = 0; x < p->n; ++x) {
+					if (p->list[x].v <= bin_off[used[l]]) continue;
+					if (n_off == m_off) {
+						m_off = m_off? m_off<<1 : 256;
+						off = (pair64_t*)realloc(off, m_off * 16);
+					}
+					off[n_off++] = p->list[x];
+				}
 			}
-			else if (is_overlap(iter->beg, iter->end, b)) return ret;
-		} else break; // end of file or error
+			bin_off[used[l]] = (uint64_t)-1;
+		}
 	}
-	iter->finished = 1;
+	free(bins); free(used); free(bin_off);
+	if (n_off > 0) {
+		iter->iter.n_off = resolve_chunks(off, n_off);
+		iter->iter.off = off;
+	} else free(off);
+	return iter;
+}
+
+int bam_miter_read(bamFile fp, bam_miter_t iter, bam1_t *b, const int **hits, int *n_hits)
+{
+	int ret, i, l;
+	if (iter->iter.off == 0 || iter->iter.finished) return -1;
+	while ((ret = read_chunks(fp, &iter->iter, b)) >= 0) {
+		int32_t tid = b->core.tid, pos = b->core.pos;
+		uint32_t rend = b->core.n_cigar? bam_calend(&b->core, bam1_cigar(b)) : pos + 1;
+		// drop the regions this and all later alignments start after
+		for (i = l = 0; i < iter->n_act; ++i) {
+			region_t *r = &iter->reg[iter->act[i]];
+			if (r->tid == tid && r->end > pos) iter->act[l++] = iter->act[i];
+		}
+		iter->n_act = l;
+		// activate the regions starting before this alignment ends
+		for (; iter->next < iter->n_reg; ++iter->next) {
+			region_t *r = &iter->reg[iter->next];
+			if (r->tid > tid || (r->tid == tid && r->beg >= rend)) break;
+			if (r->tid == tid && r->end > pos) iter->act[iter->n_act++] = iter->next;
+		}
+		if (iter->n_act == 0 && iter->next == iter->n_reg) { // past the last region
+			ret = -1;
+			break;
+		}
+		for (i = iter->n_hits = 0; i < iter->n_act; ++i) {
+			region_t *r = &iter->reg[iter->act[i]];
+			if (is_overlap(r->beg, r->end, b)) iter->hits[iter->n_hits++] = r->i;
+		}
+		if (iter->n_hits > 0) {
+			*hits = iter->hits; *n_hits = iter->n_hits;
+			return ret;
+		}
+	}
+	iter->iter.finished = 1;
 	return ret;
 }
 
+void bam_miter_destroy(bam_miter_t iter)
+{
+	if (iter) {
+		free(iter->iter.off); free(iter->reg); free(iter->act); free(iter->hits);
+		free(iter);
+	}
+}
+
 int bam_fetch(bamFile fp, const bam_index_t *idx, int tid, int beg, int end, void *data, bam_fetch_f func)
 {
 	int ret;
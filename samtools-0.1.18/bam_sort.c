@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "bam.h"
 #include "ksort.h"
 
@@ -81,12 +82,16 @@ static void swap_header_text(bam_header_t *h1, bam_header_t *h2)
                    or NULL to copy them from the first file to be merged
   @param  n    number of files to be merged
   @param  fn   names of files to be merged
+  @param  n_threads  with more than one, the output is compressed by
+                     n_threads threads; if there are no more inputs
+                     than threads, every input is also inflated ahead
+                     of the merge on a thread of its own
 
   @discussion Padding information may NOT correctly maintained. This
   function is NOT thread safe.
  */
-int bam_merge_core(int by_qname, const char *out, const char *headers, int n, char * const *fn,
-					int flag, const char *reg)
+int bam_merge_core2(int by_qname, const char *out, const char *headers, int n, char * const *fn,
+					int flag, const char *reg, int n_threads)
 {
 	bamFile fpout, *fp;
 	heap1_t *heap;
@@ -139,6 +144,7 @@ int bam_merge_core(int by_qname, const char *out, const char *headers, int n, ch
 			// FIXME: possible memory leak
 			return -1;
 		}
+		if (n_threads > 1 && n <= n_threads) bgzf_mt(fp[i], 1, 16); // read ahead 16 blocks
 		hin = bam_header_read(fp[i]);
 		if (i == 0) { // the first BAM
 			hout = hin;
@@ -216,6 +222,7 @@ int bam_merge_core(int by_qname, const char *out, const char *headers, int n, ch
 		fprintf(stderr, "[%s] fail to create the output file.\n", __func__);
 		return -1;
 	}
+	if (n_threads > 1) bgzf_mt(fpout, n_threads, 0);
 	bam_header_write(fpout, hout);
 	bam_header_destroy(hout);
 
@@ -252,12 +259,18 @@ int bam_merge_core(int by_qname, const char *out, const char *headers, int n, ch
 	return 0;
 }
 
+int bam_merge_core(int by_qname, const char *out, const char *headers, int n, char * const *fn,
+					int flag, const char *reg)
+{
+	return bam_merge_core2(by_qname, out, headers, n, fn, flag, reg, 1);
+}
+
 int bam_merge(int argc, char *argv[])
 {
-	int c, is_by_qname = 0, flag = 0, ret = 0;
+	int c, is_by_qname = 0, flag = 0, ret = 0, n_threads = 1;
 	char *fn_headers = NULL, *reg = 0;
 
-	while ((c = getopt(argc, argv, "h:nru1R:f")) >= 0) {
+	while ((c = getopt(argc, argv, "h:nru1R:f@:")) >= 0) {
 		switch (c) {
 		case 'r': flag |= MERGE_RG; break;
 		case 'f': flag |= MERGE_FORCE; break;
@@ -266,6 +279,7 @@ int bam_merge(int argc, char *argv[])
 		case '1': flag |= MERGE_LEVEL1; break;
 		case 'u': flag |= MERGE_UNCOMP; break;
 		case 'R': reg = strdup(optarg); break;
+		case '@': n_threads = atoi(optarg); break;
 		}
 	}
 	if (optind + 2 >= argc) {
@@ -277,6 +291,7 @@ int bam_merge(int argc, char *argv[])
 		fprintf(stderr, "         -f       overwrite the output BAM if exist\n");
 		fprintf(stderr, "         -1       compress level 1\n");
 		fprintf(stderr, "         -R STR   merge file in the specified region STR [all]\n");
+		fprintf(stderr, "         -@ INT   number of threads for compression [1]\n");
 		fprintf(stderr, "         -h FILE  copy the header in FILE to <out.bam> [in1.bam]\n\n");
 		fprintf(stderr, "Note: Samtools' merge does not reconstruct the @RG dictionary in the header. Users\n");
 		fprintf(stderr, "      must provide the correct header with -h, or uses Picard which properly maintains\n");
@@ -291,7 +306,7 @@ int bam_merge(int argc, char *argv[])
 			return 1;
 		}
 	}
-	if (bam_merge_core(is_by_qname, argv[optind], fn_headers, argc - optind - 1, argv + optind + 1, flag, reg) < 0) ret = 1;
+	if (bam_merge_core2(is_by_qname, argv[optind], fn_headers, argc - optind - 1, argv + optind + 1, flag, reg, n_threads) < 0) ret = 1;
 	free(reg);
 	free(fn_headers);
 	return ret;
@@ -308,12 +323,90 @@ static inline int bam1_lt(const bam1_p a, const bam1_p b)
 }
 KSORT_INIT(sort, bam1_p, bam1_lt)
 
-static void sort_blocks(int n, int k, bam1_p *buf, const char *prefix, const bam_header_t *h, int is_stdout)
+/*
+  With several threads, a chunk is cut into one part per thread; the
+  parts are sorted concurrently and then merged pairwise, also
+  concurrently, ties going to the earlier part. The result is the same
+  as that of a single ks_mergesort().
+ */
+
+typedef struct {
+	size_t beg, mid, end; // sort [beg,end), or merge [beg,mid) and [mid,end) into out
+	bam1_p *buf, *out;
+} sort_part_t;
+
+static void *sort_worker(void *data)
+{
+	sort_part_t *w = (sort_part_t*)data;
+	bam1_p *a, *b, *o;
+	if (w->out == 0) {
+		ks_mergesort(sort, w->end - w->beg, w->buf + w->beg, 0);
+		return 0;
+	}
+	a = w->buf + w->beg; b = w->buf + w->mid; o = w->out + w->beg;
+	while (a < w->buf + w->mid && b < w->buf + w->end)
+		*o++ = bam1_lt(*b, *a)? *b++ : *a++;
+	while (a < w->buf + w->mid) *o++ = *a++;
+	while (b < w->buf + w->end) *o++ = *b++;
+	return 0;
+}
+
+static void sort_parallel(size_t k, bam1_p *buf, int n_threads)
+{
+	sort_part_t *w;
+	pthread_t *tid;
+	size_t *bound;
+	bam1_p *tmp, *in;
+	int i, n_parts, *started; // started[i]: tid[i] is running w[i]; otherwise it was done inline
+
+	if (k < (size_t)n_threads * 64) n_threads = 1; // too few to be worth it
+	if (n_threads <= 1) {
+		ks_mergesort(sort, k, buf, 0);
+		return;
+	}
+	w = (sort_part_t*)calloc(n_threads, sizeof(sort_part_t));
+	tid = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+	started = (int*)calloc(n_threads, sizeof(int));
+	bound = (size_t*)calloc(n_threads + 1, sizeof(size_t));
+	for (i = 0; i <= n_threads; ++i) bound[i] = k / n_threads * i + (i < k % n_threads? i : k % n_threads);
+	for (i = 0; i < n_threads; ++i) {
+		w[i].beg = bound[i], w[i].end = bound[i+1];
+		w[i].buf = buf;
+		started[i] = pthread_create(&tid[i], 0, sort_worker, &w[i]) == 0;
+		if (!started[i]) sort_worker(&w[i]);
+	}
+	for (i = 0; i < n_threads; ++i)
+		if (started[i]) pthread_join(tid[i], 0);
+	// merge neighbouring parts until one is left, going back and forth between buf and tmp
+	tmp = (bam1_p*)malloc(k * sizeof(bam1_p));
+	in = buf;
+	for (n_parts = n_threads; n_parts > 1; n_parts = (n_parts + 1) / 2) {
+		bam1_p *out = in == buf? tmp : buf;
+		int n_pairs = n_parts / 2;
+		for (i = 0; i < n_pairs; ++i) {
+			w[i].beg = bound[2*i], w[i].mid = bound[2*i+1], w[i].end = bound[2*i+2];
+			w[i].buf = in, w[i].out = out;
+			started[i] = pthread_create(&tid[i], 0, sort_worker, &w[i]) == 0;
+			if (!started[i]) sort_worker(&w[i]);
+		}
+		if (n_parts & 1) // the odd part out is just copied
+			memcpy(out + bound[n_parts-1], in + bound[n_parts-1], (k - bound[n_parts-1]) * sizeof(bam1_p));
+		for (i = 0; i < n_pairs; ++i)
+			if (started[i]) pthread_join(tid[i], 0);
+		for (i = 0; i <= n_parts; i += 2) bound[i/2] = bound[i];
+		bound[(n_parts+1)/2] = k;
+		in = out;
+	}
+	if (in != buf) memcpy(buf, in, k * sizeof(bam1_p));
+	free(tmp); free(bound); free(started); free(tid); free(w);
+}
+
+static void sort_blocks(int n, int k, bam1_p *buf, const char *prefix, const bam_header_t *h, int is_stdout, int n_threads)
 {
 	char *name, mode[3];
 	int i;
 	bamFile fp;
-	ks_mergesort(sort, k, buf, 0);
+	sort_parallel(k, buf, n_threads);
 	name = (char*)calloc(strlen(prefix) + 20, 1);
 	if (n >= 0) {
 		sprintf(name, "%s.%.4d.bam", prefix, n);
@@ -330,6 +423,7 @@ static void sort_blocks(int n, int k, bam1_p *buf, const char *prefix, const bam
 		return;
 	}
 	free(name);
+	if (n_threads > 1) bgzf_mt(fp, n_threads, 0);
 	bam_header_write(fp, h);
 	for (i = 0; i < k; ++i)
 		bam_write1_core(fp, &buf[i]->core, buf[i]->data_len, buf[i]->data);
@@ -345,12 +439,14 @@ static void sort_blocks(int n, int k, bam1_p *buf, const char *prefix, const bam
   @param  prefix   prefix of the output and the temporary files; upon
 	                   sucessess, prefix.bam will be written.
   @param  max_mem  approxiate maximum memory (very inaccurate)
+  @param  n_threads  number of threads sorting and compressing each
+                     chunk and compressing the merged output
 
   @discussion It may create multiple temporary subalignment files
   and then merge them by calling bam_merge_core(). This function is
   NOT thread safe.
  */
-void bam_sort_core_ext(int is_by_qname, const char *fn, const char *prefix, size_t max_mem, int is_stdout)
+void bam_sort_core_ext(int is_by_qname, const char *fn, const char *prefix, size_t max_mem, int is_stdout, int n_threads)
 {
 	int n, ret, k, i;
 	size_t mem;
@@ -375,17 +471,17 @@ void bam_sort_core_ext(int is_by_qname, const char *fn, const char *prefix, size
 		mem += ret;
 		++k;
 		if (mem >= max_mem) {
-			sort_blocks(n++, k, buf, prefix, header, 0);
+			sort_blocks(n++, k, buf, prefix, header, 0, n_threads);
 			mem = 0; k = 0;
 		}
 	}
 	if (ret != -1)
 		fprintf(stderr, "[bam_sort_core] truncated file. Continue anyway.\n");
-	if (n == 0) sort_blocks(-1, k, buf, prefix, header, is_stdout);
+	if (n == 0) sort_blocks(-1, k, buf, prefix, header, is_stdout, n_threads);
 	else { // then merge
 		char **fns, *fnout;
 		fprintf(stderr, "[bam_sort_core] merging from %d files...\n", n+1);
-		sort_blocks(n++, k, buf, prefix, header, 0);
+		sort_blocks(n++, k, buf, prefix, header, 0, n_threads);
 		fnout = (char*)calloc(strlen(prefix) + 20, 1);
 		if (is_stdout) sprintf(fnout, "-");
 		else sprintf(fnout, "%s.bam", prefix);
@@ -394,7 +490,7 @@ void bam_sort_core_ext(int is_by_qname, const char *fn, const char *prefix, size
 			fns[i] = (char*)calloc(strlen(prefix) + 20, 1);
 			sprintf(fns[i], "%s.%.4d.bam", prefix, i);
 		}
-		bam_merge_core(is_by_qname, fnout, 0, n, fns, 0, 0);
+		bam_merge_core2(is_by_qname, fnout, 0, n, fns, 0, 0, n_threads);
 		free(fnout);
 		for (i = 0; i < n; ++i) {
 			unlink(fns[i]);
@@ -415,24 +511,25 @@ void bam_sort_core_ext(int is_by_qname, const char *fn, const char *prefix, size
 
 void bam_sort_core(int is_by_qname, const char *fn, const char *prefix, size_t max_mem)
 {
-	bam_sort_core_ext(is_by_qname, fn, prefix, max_mem, 0);
+	bam_sort_core_ext(is_by_qname, fn, prefix, max_mem, 0, 1);
 }
 
 int bam_sort(int argc, char *argv[])
 {
 	size_t max_mem = 500000000;
-	int c, is_by_qname = 0, is_stdout = 0;
-	while ((c = getopt(argc, argv, "nom:")) >= 0) {
+	int c, is_by_qname = 0, is_stdout = 0, n_threads = 1;
+	while ((c = getopt(argc, argv, "nom:@:")) >= 0) {
 		switch (c) {
 		case 'o': is_stdout = 1; break;
 		case 'n': is_by_qname = 1; break;
 		case 'm': max_mem = atol(optarg); break;
+		case '@': n_threads = atoi(optarg); break;
 		}
 	}
 	if (optind + 2 > argc) {
-		fprintf(stderr, "Usage: samtools sort [-on] [-m <maxMem>] <in.bam> <out.prefix>\n");
+		fprintf(stderr, "Usage: samtools sort [-on] [-m <maxMem>] [-@ <threads>] <in.bam> <out.prefix>\n");
 		return 1;
 	}
-	bam_sort_core_ext(is_by_qname, argv[optind], argv[optind+1], max_mem, is_stdout);
+	bam_sort_core_ext(is_by_qname, argv[optind], argv[optind+1], max_mem, is_stdout, n_threads);
 	return 0;
 }
@@ -22,6 +22,8 @@
 */
 
 /*
+  LRU block cache; prefetch of the chunks of an index query.
+  read-ahead: optionally inflate the next blocks on a pool of threads.
   2009-06-29 by lh3: cache recent uncompressed blocks.
   2009-06-25 by lh3: optionally use my knetfile library to access file on a FTP.
   2009-06-12 by lh3: support a mode string like "wu" where 'u' for uncompressed output */
@@ -33,15 +35,54 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include "bgzf.h"
 
 #include "khash.h"
+/* The cache keeps its entries in an array, linked into a list from the
+ * most to the least recently used; the hash table maps block addresses
+ * to entries. */
 typedef struct {
 	int size;
 	uint8_t *block;
-	int64_t end_offset;
+	int64_t block_address, end_offset;
+	int prev, next; // LRU list, -1 at the ends
 } cache_t;
-KHASH_MAP_INIT_INT64(cache, cache_t)
+KHASH_MAP_INIT_INT64(cache, int)
+
+typedef struct {
+	khash_t(cache) *h;
+	cache_t *entries;
+	int n, m;
+	int first, last; // most and least recently used
+} block_cache_t;
+
+static block_cache_t *cache_init()
+{
+	block_cache_t *c = calloc(1, sizeof(block_cache_t));
+	c->h = kh_init(cache);
+	c->first = c->last = -1;
+	return c;
+}
+
+static void cache_unlink(block_cache_t *c, int i)
+{
+	cache_t *p = &c->entries[i];
+	if (p->prev >= 0) c->entries[p->prev].next = p->next;
+	else c->first = p->next;
+	if (p->next >= 0) c->entries[p->next].prev = p->prev;
+	else c->last = p->prev;
+}
+
+static void cache_push_front(block_cache_t *c, int i)
+{
+	cache_t *p = &c->entries[i];
+	p->prev = -1;
+	p->next = c->first;
+	if (c->first >= 0) c->entries[c->first].prev = i;
+	c->first = i;
+	if (c->last < 0) c->last = i;
+}
 
 #if defined(_WIN32) || defined(_MSC_VER)
 #define ftello(fp) ftell(fp)
@@ -146,7 +187,7 @@ static BGZF *bgzf_read_init()
     fp->compressed_block_size = MAX_BLOCK_SIZE;
     fp->compressed_block = malloc(MAX_BLOCK_SIZE);
 	fp->cache_size = 0;
-	fp->cache = kh_init(cache);
+	fp->cache = cache_init();
 	return fp;
 }
 
@@ -198,6 +239,8 @@ open_write(int fd, int compress_level) // compress_level==-1 for the default lev
     fp->block_offset = 0;
     fp->block_length = 0;
     fp->error = NULL;
+    fp->next_block_address = 0;
+    fp->mt = NULL;
     return fp;
 }
 
@@ -262,14 +305,14 @@ bgzf_fdopen(int fd, const char * __restrict mode)
 
 static
 int
-deflate_block(BGZF* fp, int block_length)
+deflate_buffer(void* uncompressed, int block_length, int* input_length_out,
+               bgzf_byte_t* buffer, int buffer_size, int compress_level, const char** error)
 {
-    // Deflate the block in fp->uncompressed_block into fp->compressed_block.
+    // Deflate as much of the block_length bytes in uncompressed as fits into
+    // one BGZF block in buffer; *input_length_out is set to the number of bytes
+    // used. No BGZF state is touched, so that worker threads can call it.
     // Also adds an extra field that stores the compressed block length.
 
-    bgzf_byte_t* buffer = fp->compressed_block;
-    int buffer_size = fp->compressed_block_size;
-
     // Init gzip header
     buffer[0] = GZIP_ID1;
     buffer[1] = GZIP_ID2;
@@ -297,15 +340,15 @@ deflate_block(BGZF* fp, int block_length)
         z_stream zs;
         zs.zalloc = NULL;
         zs.zfree = NULL;
-        zs.next_in = fp->uncompressed_block;
+        zs.next_in = uncompressed;
         zs.avail_in = input_length;
         zs.next_out = (void*)&buffer[BLOCK_HEADER_LENGTH];
         zs.avail_out = buffer_size - BLOCK_HEADER_LENGTH - BLOCK_FOOTER_LENGTH;
 
-        int status = deflateInit2(&zs, fp->compress_level, Z_DEFLATED,
+        int status = deflateInit2(&zs, compress_level, Z_DEFLATED,
                                   GZIP_WINDOW_BITS, Z_DEFAULT_MEM_LEVEL, Z_DEFAULT_STRATEGY);
         if (status != Z_OK) {
-            report_error(fp, "deflate init failed");
+            *error = "deflate init failed";
             return -1;
         }
         status = deflate(&zs, Z_FINISH);
@@ -318,24 +361,24 @@ deflate_block(BGZF* fp, int block_length)
                 input_length -= 1024;
                 if (input_length <= 0) {
                     // should never happen
-                    report_error(fp, "input reduction failed");
+                    *error = "input reduction failed";
                     return -1;
                 }
                 continue;
             }
-            report_error(fp, "deflate failed");
+            *error = "deflate failed";
             return -1;
         }
         status = deflateEnd(&zs);
         if (status != Z_OK) {
-            report_error(fp, "deflate end failed");
+            *error = "deflate end failed";
             return -1;
         }
         compressed_length = zs.total_out;
         compressed_length += BLOCK_HEADER_LENGTH + BLOCK_FOOTER_LENGTH;
         if (compressed_length > MAX_BLOCK_SIZE) {
             // should never happen
-            report_error(fp, "deflate overflow");
+            *error = "deflate overflow";
             return -1;
         }
         break;
@@ -343,9 +386,24 @@ deflate_block(BGZF* fp, int block_length)
 
     packInt16((uint8_t*)&buffer[16], compressed_length-1);
     uint32_t crc = crc32(0L, NULL, 0L);
-    crc = crc32(crc, fp->uncompressed_block, input_length);
+    crc = crc32(crc, uncompressed, input_length);
     packInt32((uint8_t*)&buffer[compressed_length-8], crc);
     packInt32((uint8_t*)&buffer[compressed_length-4], input_length);
+    *input_length_out = input_length;
+    return compressed_length;
+}
+
+static
+int
+deflate_block(BGZF* fp, int block_length)
+{
+    // Deflate the block in fp->uncompressed_block into fp->compressed_block.
+
+    int input_length;
+    int compressed_length = deflate_buffer(fp->uncompressed_block, block_length, &input_length,
+                                           fp->compressed_block, fp->compressed_block_size,
+                                           fp->compress_level, &fp->error);
+    if (compressed_length < 0) return -1;
 
     int remaining = block_length - input_length;
     if (remaining > 0) {
@@ -364,38 +422,49 @@ deflate_block(BGZF* fp, int block_length)
 
 static
 int
-inflate_block(BGZF* fp, int block_length)
+inflate_buffer(void* compressed, int block_length, void* uncompressed, int uncompressed_size,
+               const char** error)
 {
-    // Inflate the block in fp->compressed_block into fp->uncompressed_block
+    // Inflate the block in compressed into uncompressed; no BGZF state is
+    // touched, so that worker threads can call it
 
     z_stream zs;
 	int status;
     zs.zalloc = NULL;
     zs.zfree = NULL;
-    zs.next_in = fp->compressed_block + 18;
+    zs.next_in = (Bytef*)compressed + 18;
     zs.avail_in = block_length - 16;
-    zs.next_out = fp->uncompressed_block;
-    zs.avail_out = fp->uncompressed_block_size;
+    zs.next_out = uncompressed;
+    zs.avail_out = uncompressed_size;
 
     status = inflateInit2(&zs, GZIP_WINDOW_BITS);
     if (status != Z_OK) {
-        report_error(fp, "inflate init failed");
+        *error = "inflate init failed";
         return -1;
     }
     status = inflate(&zs, Z_FINISH);
     if (status != Z_STREAM_END) {
         inflateEnd(&zs);
-        report_error(fp, "inflate failed");
+        *error = "inflate failed";
         return -1;
     }
     status = inflateEnd(&zs);
     if (status != Z_OK) {
-        report_error(fp, "inflate failed");
+        *error = "inflate failed";
         return -1;
     }
     return zs.total_out;
 }
 
+static
+int
+inflate_block(BGZF* fp, int block_length)
+{
+    // Inflate the block in fp->compressed_block into fp->uncompressed_block
+    return inflate_buffer(fp->compressed_block, block_length, fp->uncompressed_block,
+                          fp->uncompressed_block_size, &fp->error);
+}
+
 static
 int
 check_header(const bgzf_byte_t* header)
@@ -412,26 +481,30 @@ check_header(const bgzf_byte_t* header)
 
 static void free_cache(BGZF *fp)
 {
-	khint_t k;
-	khash_t(cache) *h = (khash_t(cache)*)fp->cache;
+	block_cache_t *c = (block_cache_t*)fp->cache;
+	int i;
 	if (fp->open_mode != 'r') return;
-	for (k = kh_begin(h); k < kh_end(h); ++k)
-		if (kh_exist(h, k)) free(kh_val(h, k).block);
-	kh_destroy(cache, h);
+	for (i = 0; i < c->n; ++i) free(c->entries[i].block);
+	free(c->entries);
+	kh_destroy(cache, c->h);
+	free(c);
 }
 
 static int load_block_from_cache(BGZF *fp, int64_t block_address)
 {
 	khint_t k;
 	cache_t *p;
-	khash_t(cache) *h = (khash_t(cache)*)fp->cache;
-	k = kh_get(cache, h, block_address);
-	if (k == kh_end(h)) return 0;
-	p = &kh_val(h, k);
+	block_cache_t *c = (block_cache_t*)fp->cache;
+	k = kh_get(cache, c->h, block_address);
+	if (k == kh_end(c->h)) return 0;
+	cache_unlink(c, kh_val(c->h, k));
+	cache_push_front(c, kh_val(c->h, k));
+	p = &c->entries[kh_val(c->h, k)];
 	if (fp->block_length != 0) fp->block_offset = 0;
 	fp->block_address = block_address;
 	fp->block_length = p->size;
-	memcpy(fp->uncompressed_block, p->block, MAX_BLOCK_SIZE);
+	fp->next_block_address = p->end_offset;
+	memcpy(fp->uncompressed_block, p->block, p->size);
 #ifdef _USE_KNETFILE
 	knet_seek(fp->x.fpr, p->end_offset, SEEK_SET);
 #else
@@ -442,29 +515,374 @@ static int load_block_from_cache(BGZF *fp, int64_t block_address)
 
 static void cache_block(BGZF *fp, int size)
 {
-	int ret;
+	int ret, i;
 	khint_t k;
 	cache_t *p;
-	khash_t(cache) *h = (khash_t(cache)*)fp->cache;
+	block_cache_t *c = (block_cache_t*)fp->cache;
 	if (MAX_BLOCK_SIZE >= fp->cache_size) return;
-	if ((kh_size(h) + 1) * MAX_BLOCK_SIZE > fp->cache_size) {
-		/* A better way would be to remove the oldest block in the
-		 * cache, but here we remove a random one for simplicity. This
-		 * should not have a big impact on performance. */
-		for (k = kh_begin(h); k < kh_end(h); ++k)
-			if (kh_exist(h, k)) break;
-		if (k < kh_end(h)) {
-			free(kh_val(h, k).block);
-			kh_del(cache, h, k);
+	if ((kh_size(c->h) + 1) * MAX_BLOCK_SIZE > fp->cache_size && c->last >= 0) {
+		// reuse the least recently used entry
+		i = c->last;
+		cache_unlink(c, i);
+		kh_del(cache, c->h, kh_get(cache, c->h, c->entries[i].block_address));
+	} else {
+		if (c->n == c->m) {
+			c->m = c->m? c->m << 1 : 16;
+			c->entries = realloc(c->entries, c->m * sizeof(cache_t));
 		}
+		i = c->n++;
+		c->entries[i].block = malloc(MAX_BLOCK_SIZE);
 	}
-	k = kh_put(cache, h, fp->block_address, &ret);
-	if (ret == 0) return; // if this happens, a bug!
-	p = &kh_val(h, k);
+	k = kh_put(cache, c->h, fp->block_address, &ret);
+	kh_val(c->h, k) = i;
+	p = &c->entries[i];
 	p->size = fp->block_length;
+	p->block_address = fp->block_address;
 	p->end_offset = fp->block_address + size;
-	p->block = malloc(MAX_BLOCK_SIZE);
-	memcpy(kh_val(h, k).block, fp->uncompressed_block, MAX_BLOCK_SIZE);
+	memcpy(p->block, fp->uncompressed_block, p->size);
+	cache_push_front(c, i);
+}
+
+void bgzf_prefetch(BGZF *fp, int64_t beg, int64_t end)
+{
+#if defined(POSIX_FADV_WILLNEED) && !defined(_WIN32)
+	int fd;
+	int64_t offset = beg >> 16;
+	// the last block may start just before the end
+	int64_t length = (end >> 16) - offset + MAX_BLOCK_SIZE;
+	if (fp->open_mode != 'r' || length <= 0) return;
+#ifdef _USE_KNETFILE
+	if (fp->x.fpr->type != KNF_TYPE_LOCAL) return;
+	fd = knet_fileno(fp->x.fpr);
+#else
+	fd = fileno(fp->file);
+#endif
+	posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+#endif
+}
+
+/*
+ * Multi-threading. For reading, the reading thread keeps up to n_blocks
+ * compressed blocks in a ring, in file order starting at head; the
+ * worker threads inflate them in any order, and bgzf_read_block() takes
+ * the head block once it is inflated. For writing, filled blocks are
+ * queued at the tail of the ring, deflated by the workers, and written
+ * in order from the head. Only the calling thread touches the file.
+ */
+
+enum { MT_EMPTY, MT_QUEUED, MT_BUSY, MT_DONE, MT_ERROR };
+
+typedef struct {
+	int state;
+	int64_t block_address, next_block_address; // reading only
+	int compressed_length, block_length;
+	void *compressed_block, *uncompressed_block;
+	const char *error;
+} mt_block_t;
+
+typedef struct {
+	char open_mode;
+	int compress_level;
+	int n_threads, n_blocks;
+	mt_block_t *blocks;
+	int head, n_filled; // the ring of blocks
+	int eof; // reading: no more blocks to read ahead
+	int stop;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cv, done_cv;
+} mt_state_t;
+
+static int64_t file_tell(BGZF *fp)
+{
+#ifdef _USE_KNETFILE
+	return knet_tell(fp->x.fpr);
+#else
+	return ftello(fp->file);
+#endif
+}
+
+static int file_read(BGZF *fp, void *data, int length)
+{
+#ifdef _USE_KNETFILE
+	return knet_read(fp->x.fpr, data, length);
+#else
+	return fread(data, 1, length, fp->file);
+#endif
+}
+
+static int file_write(BGZF *fp, const void *data, int length)
+{
+#ifdef _USE_KNETFILE
+	return fwrite(data, 1, length, fp->x.fpw);
+#else
+	return fwrite(data, 1, length, fp->file);
+#endif
+}
+
+// deflate a queued block; input that does not fit into one BGZF block
+// goes into the next, as bgzf_flush() does it
+static int mt_deflate(mt_state_t *mt, mt_block_t *b)
+{
+	int done = 0, used, n;
+	b->compressed_length = 0;
+	while (done < b->block_length) {
+		n = deflate_buffer((bgzf_byte_t*)b->uncompressed_block + done, b->block_length - done, &used,
+						   (bgzf_byte_t*)b->compressed_block + b->compressed_length, MAX_BLOCK_SIZE,
+						   mt->compress_level, &b->error);
+		if (n < 0) return -1;
+		b->compressed_length += n;
+		done += used;
+		if (done < b->block_length && b->compressed_length + MAX_BLOCK_SIZE > 2 * MAX_BLOCK_SIZE) {
+			b->error = "remainder too large";
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void *mt_worker(void *data)
+{
+	mt_state_t *mt = (mt_state_t*)data;
+	mt_block_t *b;
+	int i, ret;
+	pthread_mutex_lock(&mt->lock);
+	while (1) {
+		// the earliest block waiting to be processed
+		for (b = 0, i = 0; i < mt->n_filled; ++i) {
+			b = &mt->blocks[(mt->head + i) % mt->n_blocks];
+			if (b->state == MT_QUEUED) break;
+		}
+		if (mt->stop) break;
+		if (i == mt->n_filled) {
+			pthread_cond_wait(&mt->work_cv, &mt->lock);
+			continue;
+		}
+		b->state = MT_BUSY;
+		pthread_mutex_unlock(&mt->lock);
+		if (mt->open_mode == 'r') {
+			b->block_length = inflate_buffer(b->compressed_block, b->compressed_length,
+											 b->uncompressed_block, MAX_BLOCK_SIZE, &b->error);
+			ret = b->block_length;
+		} else ret = mt_deflate(mt, b);
+		pthread_mutex_lock(&mt->lock);
+		b->state = ret < 0? MT_ERROR : MT_DONE;
+		pthread_cond_broadcast(&mt->done_cv);
+	}
+	pthread_mutex_unlock(&mt->lock);
+	return 0;
+}
+
+// wait until the head block is processed
+static mt_block_t *mt_wait_head(mt_state_t *mt)
+{
+	mt_block_t *b = &mt->blocks[mt->head];
+	pthread_mutex_lock(&mt->lock);
+	while (b->state != MT_DONE && b->state != MT_ERROR)
+		pthread_cond_wait(&mt->done_cv, &mt->lock);
+	pthread_mutex_unlock(&mt->lock);
+	return b;
+}
+
+static void mt_pop_head(mt_state_t *mt)
+{
+	pthread_mutex_lock(&mt->lock);
+	mt->blocks[mt->head].state = MT_EMPTY;
+	mt->head = (mt->head + 1) % mt->n_blocks;
+	--mt->n_filled;
+	pthread_mutex_unlock(&mt->lock);
+}
+
+static void mt_push_tail(mt_state_t *mt, int state)
+{
+	pthread_mutex_lock(&mt->lock);
+	mt->blocks[(mt->head + mt->n_filled) % mt->n_blocks].state = state;
+	++mt->n_filled;
+	pthread_cond_signal(&mt->work_cv);
+	pthread_mutex_unlock(&mt->lock);
+}
+
+// read compressed blocks into the free slots of the ring
+static void mt_read_ahead(BGZF *fp)
+{
+	mt_state_t *mt = (mt_state_t*)fp->mt;
+	while (!mt->eof && mt->n_filled < mt->n_blocks) {
+		mt_block_t *b = &mt->blocks[(mt->head + mt->n_filled) % mt->n_blocks];
+		bgzf_byte_t *header = (bgzf_byte_t*)b->compressed_block;
+		int count, state = MT_QUEUED;
+		b->block_address = file_tell(fp);
+		count = file_read(fp, header, BLOCK_HEADER_LENGTH);
+		if (count == 0) { // end of file
+			mt->eof = 1;
+			break;
+		}
+		if (count != BLOCK_HEADER_LENGTH) {
+			b->error = "read failed";
+			state = MT_ERROR;
+		} else if (!check_header(header)) {
+			b->error = "invalid block header";
+			state = MT_ERROR;
+		} else {
+			int remaining;
+			b->compressed_length = unpackInt16((uint8_t*)&header[16]) + 1;
+			remaining = b->compressed_length - BLOCK_HEADER_LENGTH;
+			if (file_read(fp, &header[BLOCK_HEADER_LENGTH], remaining) != remaining) {
+				b->error = "read failed";
+				state = MT_ERROR;
+			}
+		}
+		b->next_block_address = b->block_address + BLOCK_HEADER_LENGTH;
+		if (state == MT_QUEUED) b->next_block_address = b->block_address + b->compressed_length;
+		else mt->eof = 1; // report the error when the block is reached
+		mt_push_tail(mt, state);
+	}
+}
+
+static int mt_read_block(BGZF *fp)
+{
+	mt_state_t *mt = (mt_state_t*)fp->mt;
+	mt_block_t *b;
+	void *tmp;
+	mt_read_ahead(fp);
+	if (mt->n_filled == 0) {
+		fp->block_length = 0;
+		return 0;
+	}
+	b = mt_wait_head(mt);
+	if (b->state == MT_ERROR) {
+		report_error(fp, b->error);
+		return -1;
+	}
+	if (fp->block_length != 0) {
+		// Do not reset offset if this read follows a seek.
+		fp->block_offset = 0;
+	}
+	fp->block_address = b->block_address;
+	fp->next_block_address = b->next_block_address;
+	fp->block_length = b->block_length;
+	tmp = fp->uncompressed_block;
+	fp->uncompressed_block = b->uncompressed_block;
+	b->uncompressed_block = tmp;
+	mt_pop_head(mt);
+	mt_read_ahead(fp);
+	return 0;
+}
+
+// write the deflated blocks at the head of the ring; with wait, until
+// min_free slots are free, otherwise only those already deflated
+static int mt_write_blocks(BGZF *fp, int min_free, int wait)
+{
+	mt_state_t *mt = (mt_state_t*)fp->mt;
+	while (mt->n_filled > 0) {
+		mt_block_t *b = &mt->blocks[mt->head];
+		if (mt->n_blocks - mt->n_filled >= min_free || !wait) {
+			int state;
+			pthread_mutex_lock(&mt->lock);
+			state = b->state;
+			pthread_mutex_unlock(&mt->lock);
+			if (state != MT_DONE && state != MT_ERROR) break;
+		}
+		b = mt_wait_head(mt);
+		if (b->state == MT_ERROR) {
+			report_error(fp, b->error);
+			return -1;
+		}
+		if (file_write(fp, b->compressed_block, b->compressed_length) != b->compressed_length) {
+			report_error(fp, "write failed");
+			return -1;
+		}
+		fp->block_address += b->compressed_length;
+		mt_pop_head(mt);
+	}
+	return 0;
+}
+
+// hand the current block to the workers
+static int mt_queue_block(BGZF *fp)
+{
+	mt_state_t *mt = (mt_state_t*)fp->mt;
+	mt_block_t *b;
+	void *tmp;
+	if (fp->block_offset == 0) return 0;
+	if (mt_write_blocks(fp, 1, 1) != 0) return -1;
+	b = &mt->blocks[(mt->head + mt->n_filled) % mt->n_blocks];
+	tmp = fp->uncompressed_block;
+	fp->uncompressed_block = b->uncompressed_block;
+	b->uncompressed_block = tmp;
+	b->block_length = fp->block_offset;
+	fp->block_offset = 0;
+	mt_push_tail(mt, MT_QUEUED);
+	return mt_write_blocks(fp, 0, 0);
+}
+
+// drop the blocks read ahead, e.g. before a seek
+static void mt_reset(BGZF *fp)
+{
+	mt_state_t *mt = (mt_state_t*)fp->mt;
+	int i;
+	pthread_mutex_lock(&mt->lock);
+	for (i = 0; i < mt->n_filled; ++i) {
+		mt_block_t *b = &mt->blocks[(mt->head + i) % mt->n_blocks];
+		while (b->state == MT_BUSY)
+			pthread_cond_wait(&mt->done_cv, &mt->lock);
+		b->state = MT_EMPTY;
+	}
+	mt->head = mt->n_filled = mt->eof = 0;
+	pthread_mutex_unlock(&mt->lock);
+}
+
+static void mt_destroy(BGZF *fp)
+{
+	mt_state_t *mt = (mt_state_t*)fp->mt;
+	int i;
+	pthread_mutex_lock(&mt->lock);
+	mt->stop = 1;
+	pthread_cond_broadcast(&mt->work_cv);
+	pthread_mutex_unlock(&mt->lock);
+	for (i = 0; i < mt->n_threads; ++i)
+		pthread_join(mt->threads[i], 0);
+	for (i = 0; i < mt->n_blocks; ++i) {
+		free(mt->blocks[i].compressed_block);
+		free(mt->blocks[i].uncompressed_block);
+	}
+	pthread_mutex_destroy(&mt->lock);
+	pthread_cond_destroy(&mt->work_cv);
+	pthread_cond_destroy(&mt->done_cv);
+	free(mt->blocks);
+	free(mt->threads);
+	free(mt);
+	fp->mt = 0;
+}
+
+int bgzf_mt(BGZF *fp, int n_threads, int n_blocks)
+{
+	mt_state_t *mt;
+	int i;
+	if (fp->mt || n_threads < 1) return -1;
+	if (n_blocks <= 0) n_blocks = 4 * n_threads;
+	mt = calloc(1, sizeof(mt_state_t));
+	mt->open_mode = fp->open_mode;
+	mt->compress_level = fp->compress_level;
+	mt->n_blocks = n_blocks;
+	mt->blocks = calloc(n_blocks, sizeof(mt_block_t));
+	for (i = 0; i < n_blocks; ++i) {
+		// a block written may not fit into one BGZF block
+		mt->blocks[i].compressed_block = malloc(fp->open_mode == 'w'? 2 * MAX_BLOCK_SIZE : MAX_BLOCK_SIZE);
+		mt->blocks[i].uncompressed_block = malloc(MAX_BLOCK_SIZE);
+	}
+	pthread_mutex_init(&mt->lock, 0);
+	pthread_cond_init(&mt->work_cv, 0);
+	pthread_cond_init(&mt->done_cv, 0);
+	mt->threads = calloc(n_threads, sizeof(pthread_t));
+	// run with the workers that could be started; mt_destroy joins only those
+	for (mt->n_threads = 0; mt->n_threads < n_threads; ++mt->n_threads)
+		if (pthread_create(&mt->threads[mt->n_threads], 0, mt_worker, mt) != 0) break;
+	fp->mt = mt;
+	if (mt->n_threads == 0) { // nothing would ever fill a block; stay single-threaded
+		mt_destroy(fp);
+		return -1;
+	}
+	return 0;
 }
 
 int
@@ -472,6 +890,7 @@ bgzf_read_block(BGZF* fp)
 {
     bgzf_byte_t header[BLOCK_HEADER_LENGTH];
 	int count, size = 0, block_length, remaining;
+	if (fp->mt) return mt_read_block(fp);
 #ifdef _USE_KNETFILE
     int64_t block_address = knet_tell(fp->x.fpr);
 	if (load_block_from_cache(fp, block_address)) return 0;
@@ -515,6 +934,7 @@ bgzf_read_block(BGZF* fp)
         fp->block_offset = 0;
     }
     fp->block_address = block_address;
+    fp->next_block_address = block_address + size;
     fp->block_length = count;
 	cache_block(fp, size);
     return 0;
@@ -553,11 +973,7 @@ bgzf_read(BGZF* fp, void* data, int length)
         bytes_read += copy_length;
     }
     if (fp->block_offset == fp->block_length) {
-#ifdef _USE_KNETFILE
-        fp->block_address = knet_tell(fp->x.fpr);
-#else
-        fp->block_address = ftello(fp->file);
-#endif
+        fp->block_address = fp->next_block_address;
         fp->block_offset = 0;
         fp->block_length = 0;
     }
@@ -566,6 +982,10 @@ bgzf_read(BGZF* fp, void* data, int length)
 
 int bgzf_flush(BGZF* fp)
 {
+    if (fp->mt) {
+        if (mt_queue_block(fp) != 0) return -1;
+        return mt_write_blocks(fp, ((mt_state_t*)fp->mt)->n_blocks, 1);
+    }
     while (fp->block_offset > 0) {
         int count, block_length;
 		block_length = deflate_block(fp, fp->block_offset);
@@ -587,7 +1007,7 @@ int bgzf_flush(BGZF* fp)
 int bgzf_flush_try(BGZF *fp, int size)
 {
 	if (fp->block_offset + size > fp->uncompressed_block_size)
-		return bgzf_flush(fp);
+		return fp->mt? mt_queue_block(fp) : bgzf_flush(fp);
 	return -1;
 }
 
@@ -614,7 +1034,7 @@ int bgzf_write(BGZF* fp, const void* data, int length)
         input += copy_length;
         bytes_written += copy_length;
         if (fp->block_offset == block_length) {
-            if (bgzf_flush(fp) != 0) {
+            if ((fp->mt? mt_queue_block(fp) : bgzf_flush(fp)) != 0) {
                 break;
             }
         }
@@ -643,6 +1063,7 @@ int bgzf_close(BGZF* fp)
             return -1;
         }
     }
+    if (fp->mt) mt_destroy(fp);
     if (fp->owned_file) {
 #ifdef _USE_KNETFILE
 		int ret;
@@ -699,6 +1120,13 @@ int64_t bgzf_seek(BGZF* fp, int64_t pos, int where)
     }
     block_offset = pos & 0xFFFF;
     block_address = (pos >> 16) & 0xFFFFFFFFFFFFLL;
+    if (!fp->mt && fp->block_length > 0 && block_address == fp->block_address) {
+        // within the loaded block, e.g. the next query starts where the
+        // last one ended; the file is still positioned after the block
+        fp->block_offset = block_offset;
+        return 0;
+    }
+    if (fp->mt) mt_reset(fp);
 #ifdef _USE_KNETFILE
     if (knet_seek(fp->x.fpr, block_address, SEEK_SET) != 0) {
 #else
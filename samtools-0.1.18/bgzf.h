@@ -55,6 +55,8 @@ typedef struct {
 	int cache_size;
     const char* error;
 	void *cache; // a pointer to a hash table
+	int64_t next_block_address; // file offset just past the loaded block
+	void *mt; // multi-threading state, see bgzf_mt()
 } BGZF;
 
 #ifdef __cplusplus
@@ -120,10 +122,31 @@ int64_t bgzf_seek(BGZF* fp, int64_t pos, int where);
 /*
  * Set the cache size. Zero to disable. By default, caching is
  * disabled. The recommended cache size for frequent random access is
- * about 8M bytes.
+ * about 8M bytes. When full, the least recently used block is dropped.
  */
 void bgzf_set_cache_size(BGZF *fp, int cache_size);
 
+/*
+ * Ask the OS to read the blocks between the virtual file offsets beg
+ * and end ahead of use (local files only).
+ */
+void bgzf_prefetch(BGZF *fp, int64_t beg, int64_t end);
+
+/*
+ * Compress or decompress with n_threads worker threads, keeping up to
+ * n_blocks blocks (0 for a default of 4 per thread) in flight.
+ * Reading: blocks are read ahead and inflated while the caller consumes
+ * the current one; reading, telling and seeking behave as before, and
+ * the block cache is bypassed.
+ * Writing: filled blocks are deflated by the workers and written in
+ * order, byte-identical to single-threaded output; bgzf_tell does not
+ * account for blocks still in flight.
+ * Call right after opening. Returns zero on success, -1 on error or if
+ * no worker thread could be started, in which case fp stays
+ * single-threaded; fewer workers than asked for may be running.
+ */
+int bgzf_mt(BGZF *fp, int n_threads, int n_blocks);
+
 int bgzf_check_EOF(BGZF *fp);
 int bgzf_read_block(BGZF* fp);
 int bgzf_flush(BGZF* fp);
@@ -143,11 +166,7 @@ static inline int bgzf_getc(BGZF *fp)
 	}
 	c = ((unsigned char*)fp->uncompressed_block)[fp->block_offset++];
     if (fp->block_offset == fp->block_length) {
-#ifdef _USE_KNETFILE
-        fp->block_address = knet_tell(fp->x.fpr);
-#else
-        fp->block_address = ftello(fp->file);
-#endif
+        fp->block_address = fp->next_block_address;
         fp->block_offset = 0;
         fp->block_length = 0;
     }
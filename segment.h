@@ -0,0 +1,141 @@
+//  Copyright (c) 2013 University of Pennsylvania
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+
+
+// maxGap/minRun segmentation of a coverage signal into loci, as done by
+// performSegmentation in RSEQtools/mrf/segmentationUtil.c. Its run-based
+// twin there, performRunSegmentation (bgrSegmenter), must give the same
+// loci for the same bedGraph; keep the two in step
+
+#ifndef CORAL_SEGMENT_H
+#define CORAL_SEGMENT_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+
+struct Segment {
+  std::string chr;
+  int start, end;
+  char strand;
+};
+
+// consumes the coverage of one chromosome/strand as bedGraph-style runs
+// (0-based, half-open, in increasing order, uncovered gaps left out)
+// without expanding them to single positions. Like bgrSegmenter it
+// works on 1-based positions, fills the gaps with 0 from position 0 on
+// and reports segments as [first position, last position + 1]
+class MaxGapSegmenter {
+  double threshold;
+  int max_gap, min_run;
+  std::vector<Segment> &out;
+  Segment seg;
+  bool in_segment;
+  int end_position;   // last position above threshold
+  int below;          // positions below threshold since end_position
+  int prev_end;       // next position not yet seen
+
+  // a run of positions [start, end) with a constant value
+  void add_positions(int start, int end, double value) {
+    if (end <= start)
+      return;
+    if (value >= threshold) {
+      if (!in_segment) {
+	in_segment = true;
+	seg.start = start;
+	end_position = start + 1;
+	below = 0;
+	if (end - start == 1)
+	  return;
+      }
+      below = 0;
+      end_position = end - 1;
+    } else if (in_segment) {
+      below += end - start;
+      if (below >= max_gap)
+	finish_segment();
+    }
+  }
+
+  void finish_segment() {
+    if (end_position - seg.start >= min_run) {
+      seg.end = end_position + 1;
+      out.push_back(seg);
+    }
+    in_segment = false;
+  }
+
+public:
+  MaxGapSegmenter(double threshold, int max_gap, int min_run,
+		  std::vector<Segment> &out) :
+    threshold(threshold), max_gap(max_gap), min_run(min_run), out(out),
+    in_segment(false), end_position(0), below(0), prev_end(0) { }
+
+  void begin(const std::string &chr, char strand) {
+    seg.chr = chr;
+    seg.strand = strand;
+    in_segment = false;
+    prev_end = 0;
+  }
+
+  // bases [start, end) have the given coverage
+  void add(int start, int end, double value) {
+    add_positions(prev_end, start + 1, 0);
+    add_positions(start + 1, end + 1, value);
+    prev_end = end + 1;
+  }
+
+  void finish() {
+    if (in_segment)
+      finish_segment();
+  }
+};
+
+// the order in which the loci of different chromosomes are numbered:
+// segment_bigwig_into_loci.sh numbered them in the glob order of its
+// per-chromosome files <chr>_split.bed, i.e. by the byte order of
+// chr + "_split", which puts chr10 before chr1 ('0' < '_')
+inline bool split_file_order(const std::string &a, const std::string &b) {
+  static const char suffix[] = "_split";
+  const size_t n_suffix = sizeof(suffix) - 1;
+  size_t na = a.size() + n_suffix, nb = b.size() + n_suffix;
+  for(size_t i=0; i < na && i < nb; ++i) {
+    unsigned char ca = i < a.size() ? a[i] : suffix[i - a.size()];
+    unsigned char cb = i < b.size() ? b[i] : suffix[i - b.size()];
+    if (ca != cb)
+      return ca < cb;
+  }
+  return na < nb;
+}
+
+// write loci.bed lines, numbering the loci SL0000000001, ...
+inline void write_segments(std::ostream &os, const std::vector<Segment> &segments,
+			   size_t &n_written) {
+  char name[32];
+  for(size_t i=0; i < segments.size(); ++i) {
+    const Segment &s = segments[i];
+    sprintf(name, "SL%010lu", (unsigned long)++n_written);
+    os << s.chr << "\t" << s.start << "\t" << s.end << "\t" << name
+       << "\t0\t" << s.strand << "\n";
+  }
+}
+
+#endif
@@ -0,0 +1,238 @@
+//  Copyright (c) 2013 University of Pennsylvania
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+
+
+// segment genome-wide plus/minus strand bedGraph files into loci with the
+// maxGap/minRun algorithm; chromosomes are segmented by a pool of worker
+// threads while the bedGraphs are being read
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <set>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+#include <pthread.h>
+#include "segment.h"
+
+using namespace std;
+
+bool verbose = true;
+
+struct BedGraphRun {
+  int start, end;
+  float value;
+};
+
+// the coverage of one chromosome/strand and the loci found in it
+struct SegmentationTask {
+  string chr;
+  int strand;     // 0 is "+", 1 is "-"
+  vector<BedGraphRun> runs;
+  vector<Segment> segments;
+};
+
+bool task_order(const SegmentationTask *a, const SegmentationTask *b) {
+  // minus strand first, then chromosomes in the order of the split
+  // files of segment_bigwig_into_loci.sh (chr10 before chr1), as it
+  // numbered them
+  if (a->strand != b->strand)
+    return a->strand > b->strand;
+  return split_file_order(a->chr, b->chr);
+}
+
+// tasks are queued by the reader and taken by the workers; the queue is
+// bounded so that only a few chromosomes are held in memory at a time
+struct TaskQueue {
+  deque<SegmentationTask *> tasks;
+  size_t max_size;
+  bool done;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty, not_full;
+  double threshold;
+  int max_gap, min_run;
+};
+
+void push_task(TaskQueue &q, SegmentationTask *task) {
+  pthread_mutex_lock(&q.lock);
+  while (q.tasks.size() >= q.max_size)
+    pthread_cond_wait(&q.not_full, &q.lock);
+  q.tasks.push_back(task);
+  pthread_cond_signal(&q.not_empty);
+  pthread_mutex_unlock(&q.lock);
+}
+
+void *segment_worker(void *data) {
+  TaskQueue &q = *(TaskQueue *) data;
+  while (true) {
+    pthread_mutex_lock(&q.lock);
+    while (q.tasks.empty() && !q.done)
+      pthread_cond_wait(&q.not_empty, &q.lock);
+    if (q.tasks.empty()) {
+      pthread_mutex_unlock(&q.lock);
+      break;
+    }
+    SegmentationTask *task = q.tasks.front();
+    q.tasks.pop_front();
+    pthread_cond_signal(&q.not_full);
+    pthread_mutex_unlock(&q.lock);
+
+    const char strand_name[2] = {'+', '-'};
+    MaxGapSegmenter segmenter(q.threshold, q.max_gap, q.min_run, task->segments);
+    segmenter.begin(task->chr, strand_name[task->strand]);
+    for(size_t i=0; i < task->runs.size(); ++i)
+      segmenter.add(task->runs[i].start, task->runs[i].end, task->runs[i].value);
+    segmenter.finish();
+    vector<BedGraphRun>().swap(task->runs);
+  }
+  return NULL;
+}
+
+// read one strand's bedGraph and queue a task per chromosome; false on
+// errors. Each chromosome must be contiguous and sorted by position
+bool read_bedgraph(const char *fn, int strand, TaskQueue &q,
+		   vector<SegmentationTask *> &all_tasks) {
+  ifstream in(fn);
+  if (!in.is_open()) {
+    cerr << "Could not open bedGraph file " << fn << "\n";
+    return false;
+  }
+  set<string> seen_chrs;
+  SegmentationTask *task = NULL;
+  string line, chr, s;
+  while (getline(in, line)) {
+    if (line.empty() || line.compare(0, 5, "track") == 0 ||
+	line.compare(0, 5, "chrom") == 0 || line[0] == '#')
+      continue;
+    istringstream line_str(line);
+    getline(line_str, chr, '\t');
+    BedGraphRun run;
+    getline(line_str, s, '\t');
+    run.start = atoi(s.c_str());
+    getline(line_str, s, '\t');
+    run.end = atoi(s.c_str());
+    getline(line_str, s, '\t');
+    run.value = atof(s.c_str());
+
+    if (task == NULL || chr != task->chr) {
+      if (task)
+	push_task(q, task);
+      if (!seen_chrs.insert(chr).second) {
+	cerr << "\nbedGraph file " << fn << " is not sorted by chromosome\n";
+	return false;
+      }
+      if (verbose)
+	cerr << chr << (strand ? "-" : "+") << "... ";
+      task = new SegmentationTask;
+      task->chr = chr;
+      task->strand = strand;
+      all_tasks.push_back(task);
+    } else if (run.start < task->runs.back().end) {
+      cerr << "\nbedGraph file " << fn << " is not sorted by position\n";
+      return false;
+    }
+    task->runs.push_back(run);
+  }
+  if (task)
+    push_task(q, task);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int n_threads = 1;
+  int c;
+  while ((c = getopt(argc, argv, "t:")) >= 0) {
+    switch (c) {
+    case 't': n_threads = max(1, atoi(optarg)); break;
+    default: return 1;
+    }
+  }
+  if (argc - optind < 6) {
+    cerr << "USAGE: " << argv[0]
+	 << " [-t threads] plus.bedgraph minus.bedgraph threshold maxgap minrun out.bed\n";
+    return 1;
+  }
+  const char *bedgraph_fns[2] = {argv[optind], argv[optind+1]};
+  const char *out_fn = argv[optind+5];
+
+  TaskQueue q;
+  q.max_size = 2 * n_threads;
+  q.done = false;
+  q.threshold = atof(argv[optind+2]);
+  q.max_gap = atoi(argv[optind+3]);
+  q.min_run = atoi(argv[optind+4]);
+  pthread_mutex_init(&q.lock, NULL);
+  pthread_cond_init(&q.not_empty, NULL);
+  pthread_cond_init(&q.not_full, NULL);
+
+  // the reader blocks on the bounded queue until a worker takes from
+  // it, so at least one worker must run
+  vector<pthread_t> threads(n_threads);
+  int n_started = 0;
+  while (n_started < n_threads &&
+	 pthread_create(&threads[n_started], NULL, segment_worker, &q) == 0)
+    ++n_started;
+  if (n_started == 0) {
+    cerr << "Failed to start any threads\n";
+    pthread_cond_destroy(&q.not_full);
+    pthread_cond_destroy(&q.not_empty);
+    pthread_mutex_destroy(&q.lock);
+    return 1;
+  } else if (n_started < n_threads)
+    cerr << "Warning: started only " << n_started << " of " << n_threads
+	 << " threads\n";
+
+  vector<SegmentationTask *> all_tasks;
+  bool ok = true;
+  for(int strand=0; strand < 2 && ok; ++strand)
+    ok = read_bedgraph(bedgraph_fns[strand], strand, q, all_tasks);
+
+  pthread_mutex_lock(&q.lock);
+  q.done = true;
+  pthread_cond_broadcast(&q.not_empty);
+  pthread_mutex_unlock(&q.lock);
+  for(int t=0; t < n_started; ++t)
+    pthread_join(threads[t], NULL);
+  pthread_cond_destroy(&q.not_full);
+  pthread_cond_destroy(&q.not_empty);
+  pthread_mutex_destroy(&q.lock);
+  if (verbose)
+    cerr << "\n";
+  if (!ok)
+    return 1;
+
+  // number the loci in a fixed order, whichever thread found them
+  ofstream out(out_fn);
+  if (!out.is_open()) {
+    cerr << "Could not open " << out_fn << "\n";
+    return 1;
+  }
+  sort(all_tasks.begin(), all_tasks.end(), task_order);
+  size_t n_written = 0;
+  for(size_t i=0; i < all_tasks.size(); ++i) {
+    write_segments(out, all_tasks[i]->segments, n_written);
+    delete all_tasks[i];
+  }
+  return 0;
+}
@@ -20,12 +20,10 @@
 #  DEALINGS IN THE SOFTWARE.
 
 # segments RNAseq data into "transcriptionally active regions"
-#
-# NOTE: USES A LOT OF RAM! (>4G) due to bgrSegmenter. watch out
 
 if [ $# -lt 6 ]
 then
-  echo "USAGE: `basename $0` pos.bigwig neg.bigwig threshold maxgap minrun output.bed"
+  echo "USAGE: `basename $0` pos.bigwig neg.bigwig threshold maxgap minrun output.bed [threads]"
   exit 1
 fi
 
@@ -35,42 +33,17 @@ THRESHOLD=$3
 MAXGAP=$4
 MINRUN=$5
 OUTBED=$6
+THREADS=${7:-1}
 
 bigWigToBedGraph $POSBW $TMPDIR/$$.plus.bgr&
 bigWigToBedGraph $NEGBW $TMPDIR/$$.minus.bgr&
 wait
 
-# split bedGraph files up by chromosome name
-awk '{print > "'${TMPDIR}/$$'.plus."$1"_split.bgr"}' $TMPDIR/$$.plus.bgr&
-awk '{print > "'${TMPDIR}/$$'.minus."$1"_split.bgr"}' $TMPDIR/$$.minus.bgr&
-wait
-
-for inbgr in `find $TMPDIR/$$.*_split.bgr | sort`; do
-  echo `basename ${inbgr}`...
-  good=`awk '{tot += $4; lines++} END{if(tot >= '$THRESHOLD' && lines > 1) {
-      print 1 } else { print 0 }}' $inbgr`
-
-  if [ $good -eq 0 ]
-  then
-    echo "skipped."
-    continue
-  fi
-
-  inprefix=`echo $inbgr | sed -e 's/.bgr$//'`
-  strand="+"
-  t=`echo basename $inbgr | grep -c minus`
-  if [ `echo basename $inbgr | grep -c minus` -eq 1 ]
-  then
-      strand="-"
-  fi
-  bgrSegmenter $inprefix $THRESHOLD $MAXGAP $MINRUN  | \
-      awk '{print $0"\tx\t0\t'$strand'" }' > \
-      ${inprefix}.bed
-done
-
-cat $TMPDIR/$$.*_split.bed | \
-  awk '{printf "%s\t%s\t%s\tSL%010d\t%s\t%s\n",$1,$2,$3,NR,$5,$6 }' >\
-  $TMPDIR/$$.bgrseg.bed
+# chromosomes/strands are segmented in parallel; loci are numbered
+# minus strand first, then in the order the per-chromosome split files
+# used to be globbed (chr10 before chr1)
+segment_bedgraphs_into_loci -t $THREADS $TMPDIR/$$.plus.bgr $TMPDIR/$$.minus.bgr \
+  $THRESHOLD $MAXGAP $MINRUN $TMPDIR/$$.bgrseg.bed
 
 mv $TMPDIR/$$.bgrseg.bed $OUTBED
 
@@ -0,0 +1,192 @@
+//  Copyright (c) 2013 University of Pennsylvania
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+
+
+// segment the strand-specific read coverage of a sorted BAM file into
+// loci with the maxGap/minRun algorithm, without going through
+// bedGraph/bigWig files
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <queue>
+#include <algorithm>
+#include <cstdlib>
+#include <climits>
+#include "sam.h"
+#include "segment.h"
+
+using namespace std;
+
+bool verbose = true;
+
+// a change in coverage at a position: +1 where an aligned block starts
+// and -1 where it ends
+typedef pair<int, int> CoverageEvent;
+typedef priority_queue< CoverageEvent, vector<CoverageEvent>,
+			greater<CoverageEvent> > coverage_event_heap;
+
+// sweeps the coverage of one strand along a chromosome; aligned blocks
+// are split at skipped (N) bases like genomeCoverageBed -split, and the
+// coverage between consecutive events is passed on as one run
+class StrandCoverage {
+  coverage_event_heap events;
+  int coverage;
+  int front_pos;     // coverage before this bp has been passed on
+  MaxGapSegmenter &segmenter;
+
+public:
+  StrandCoverage(MaxGapSegmenter &s) : coverage(0), front_pos(0), segmenter(s) { }
+
+  void add_read(const bam1_t *b) {
+    const uint32_t *cigar = bam1_cigar(b);
+    int pos = b->core.pos, block_start = pos;
+    for(int k=0; k < b->core.n_cigar; ++k) {
+      int op = cigar[k] & BAM_CIGAR_MASK;
+      int len = cigar[k] >> BAM_CIGAR_SHIFT;
+      if (op == BAM_CREF_SKIP) {
+	add_block(block_start, pos);
+	block_start = pos + len;
+      }
+      if (op == BAM_CMATCH || op == BAM_CDEL || op == BAM_CREF_SKIP ||
+	  op == BAM_CEQUAL || op == BAM_CDIFF)
+	pos += len;
+    }
+    add_block(block_start, pos);
+  }
+
+  // pass on the coverage before pos; later reads must not start before it
+  void advance(int pos) {
+    while (!events.empty() && events.top().first < pos) {
+      int event_pos = events.top().first;
+      if (coverage > 0 && event_pos > front_pos)
+	segmenter.add(front_pos, event_pos, coverage);
+      while (!events.empty() && events.top().first == event_pos) {
+	coverage += events.top().second;
+	events.pop();
+      }
+      front_pos = event_pos;
+    }
+  }
+
+  void finish() {
+    advance(INT_MAX);
+    segmenter.finish();
+  }
+
+private:
+  void add_block(int start, int end) {
+    if (end <= start)
+      return;
+    events.push(CoverageEvent(start, 1));
+    events.push(CoverageEvent(end, -1));
+  }
+};
+
+bool by_chr(const Segment &a, const Segment &b) {
+  return split_file_order(a.chr, b.chr);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 6) {
+    cerr << "USAGE: " << argv[0]
+	 << " in.bam threshold maxgap minrun out.bed\n";
+    return 1;
+  }
+  const char *bam_fn = argv[1];
+  double threshold = atof(argv[2]);
+  int max_gap = atoi(argv[3]);
+  int min_run = atoi(argv[4]);
+  const char *out_fn = argv[5];
+
+  bamFile fp;
+  if ((fp = bam_open(bam_fn, "r")) == 0) {
+    cerr << "Failed to open BAM file " << bam_fn << "\n";
+    return 1;
+  }
+  bam_header_t *hdr = bam_header_read(fp);
+
+  // segments per strand; "+" is 0 and "-" is 1, as bam1_strand()
+  vector<Segment> segments[2];
+  MaxGapSegmenter *segmenters[2];
+  StrandCoverage *coverage[2] = {0, 0};
+  const char strand_name[2] = {'+', '-'};
+  for(int s=0; s < 2; ++s)
+    segmenters[s] = new MaxGapSegmenter(threshold, max_gap, min_run,
+					segments[s]);
+
+  bam1_t *b = bam_init1();
+  int prev_tid = -1, prev_pos = 0;
+  while (bam_read1(fp, b) >= 0) {
+    if (b->core.flag & BAM_FUNMAP || b->core.tid < 0)
+      continue;
+    if (b->core.tid != prev_tid) {
+      for(int s=0; s < 2; ++s) {
+	if (coverage[s]) {
+	  coverage[s]->finish();
+	  delete coverage[s];
+	}
+	segmenters[s]->begin(hdr->target_name[b->core.tid], strand_name[s]);
+	coverage[s] = new StrandCoverage(*segmenters[s]);
+      }
+      if (verbose)
+	cerr << hdr->target_name[b->core.tid] << "... ";
+      prev_tid = b->core.tid;
+      prev_pos = 0;
+    }
+    if (b->core.pos < prev_pos) {
+      cerr << "\nBAM file " << bam_fn << " is not sorted by position\n";
+      return 1;
+    }
+    prev_pos = b->core.pos;
+    for(int s=0; s < 2; ++s)
+      coverage[s]->advance(b->core.pos);
+    coverage[bam1_strand(b)]->add_read(b);
+  }
+  for(int s=0; s < 2; ++s) {
+    if (coverage[s]) {
+      coverage[s]->finish();
+      delete coverage[s];
+    }
+    delete segmenters[s];
+  }
+  if (verbose)
+    cerr << "\n";
+
+  // number the loci as segment_bigwig_into_loci.sh did: minus strand
+  // first, then chromosomes in the order of its split files (chr10
+  // before chr1)
+  ofstream out(out_fn);
+  if (!out.is_open()) {
+    cerr << "Could not open " << out_fn << "\n";
+    return 1;
+  }
+  size_t n_written = 0;
+  for(int s=1; s >= 0; --s) {
+    stable_sort(segments[s].begin(), segments[s].end(), by_chr);
+    write_segments(out, segments[s], n_written);
+  }
+
+  bam_destroy1(b);
+  bam_header_destroy(hdr);
+  bam_close(fp);
+  return 0;
+}
@@ -0,0 +1,120 @@
+//  Copyright (c) 2013 University of Pennsylvania
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+
+
+// splitting tab-separated lines and parsing their numbers in place,
+// without istringstreams or temporary strings
+
+#ifndef CORAL_TOKENIZER_H
+#define CORAL_TOKENIZER_H
+
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+// the fields of a line as [begin,end) pointers into it; like
+// getline(..., '\t') on an istringstream, an empty line has no fields
+// and a trailing separator does not start another one
+class FieldTokenizer {
+  const char *p, *end;
+
+public:
+  FieldTokenizer(const char *begin, const char *end) : p(begin), end(end) { }
+  explicit FieldTokenizer(const std::string &line) :
+    p(line.data()), end(line.data() + line.size()) { }
+
+  bool next(const char *&field_begin, const char *&field_end, char sep='\t') {
+    if (p >= end)
+      return false;
+    field_begin = p;
+    const char *q = (const char *) memchr(p, sep, end - p);
+    field_end = q ? q : end;
+    p = field_end + 1;
+    return true;
+  }
+
+  // the next field copied into s (reusing its buffer); s is left
+  // unchanged if there are no more fields
+  bool next(std::string &s, char sep='\t') {
+    const char *b, *e;
+    if (!next(b, e, sep))
+      return false;
+    s.assign(b, e - b);
+    return true;
+  }
+
+  // skip the next field
+  bool skip(char sep='\t') {
+    const char *b, *e;
+    return next(b, e, sep);
+  }
+};
+
+// the integer at the start of [b,e), as atol: 0 if there is none
+inline long parse_long(const char *b, const char *e) {
+  while (b < e && (*b == ' ' || *b == '\t'))
+    ++b;
+  bool neg = false;
+  if (b < e && (*b == '-' || *b == '+'))
+    neg = (*b++ == '-');
+  long x = 0;
+  for(; b < e && *b >= '0' && *b <= '9'; ++b)
+    x = 10*x + (*b - '0');
+  return neg ? -x : x;
+}
+
+// the number at the start of [b,e), as atof.  Plain decimals of up to
+// 15 significant digits are converted exactly (an exact integer divided
+// by an exact power of ten rounds the same as strtod); anything else
+// (exponents, long mantissas, inf/nan) goes through strtod
+inline double parse_double(const char *b, const char *e) {
+  static const double pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  const char *p = b;
+  bool neg = false;
+  if (p < e && (*p == '-' || *p == '+'))
+    neg = (*p++ == '-');
+  uint64_t mantissa = 0;
+  int n_digits = 0, n_frac = 0;
+  const char *digits_start = p;
+  for(; p < e && *p >= '0' && *p <= '9'; ++p, ++n_digits)
+    mantissa = 10*mantissa + (*p - '0');
+  if (p < e && *p == '.')
+    for(++p; p < e && *p >= '0' && *p <= '9'; ++p, ++n_digits, ++n_frac)
+      mantissa = 10*mantissa + (*p - '0');
+  bool plain = p > digits_start && n_digits <= 15 &&
+    (p == e || (*p != 'e' && *p != 'E'));
+  if (plain) {
+    double x = double(mantissa) / pow10[n_frac];
+    return neg ? -x : x;
+  }
+  // strtod needs a terminated string
+  char buf[64];
+  size_t n = std::min(size_t(e - b), sizeof(buf) - 1);
+  memcpy(buf, b, n);
+  buf[n] = '\0';
+  return strtod(buf, NULL);
+}
+
+#endif